@@ -138,6 +138,7 @@ static const char *prefsFileName_App_      = PREFS_NAME ".cfg";
 static const char *oldStateFileName_App_   = STATE_NAME ".binary";
 static const char *stateFileName_App_      = STATE_NAME ".lgr";
 static const char *tempStateFileName_App_  = STATE_NAME ".lgr.tmp";
+static const char *contentDirName_App_     = STATE_NAME "-content";
 static const char *defaultDownloadDir_App_ = "~/Downloads";
 
 static const int    idleThreshold_App_             = 1000; /* ms */
@@ -179,6 +180,7 @@ struct Impl_App {
     int          autoReloadTimer; /* TODO: only start this when tabs are autoreloading */
     iPeriodic    periodic;
     int          warmupFrames; /* forced refresh just after resuming from background; FIXME: shouldn't be needed */
+    iBool        hasDormantTabs; /* restored tabs waiting to be shown or for idle time */
 #if defined (LAGRANGE_ENABLE_IDLE_SLEEP)
     iBool        isIdling;
     uint32_t     lastEventTime;
@@ -320,6 +322,8 @@ static iString *serializePrefs_App_(const iApp *d) {
     appendFormat_String(str, "uploadzoom.set arg:%d\n", d->prefs.editorZoomLevel);
     appendFormat_String(str, "pinsplit.set arg:%d\n", d->prefs.pinSplit);
     appendFormat_String(str, "feedinterval.set arg:%d\n", d->prefs.feedInterval);
+    appendFormat_String(str, "feedconcurrency.set arg:%d host:%d\n",
+                        d->prefs.feedConcurrency, d->prefs.feedHostConcurrency);
     appendFormat_String(str, "smoothscroll arg:%d\n", d->prefs.smoothScrolling);
     appendFormat_String(str, "scrollspeed arg:%d type:%d\n", d->prefs.smoothScrollSpeed[keyboard_ScrollType], keyboard_ScrollType);
     appendFormat_String(str, "scrollspeed arg:%d type:%d\n", d->prefs.smoothScrollSpeed[mouse_ScrollType], mouse_ScrollType);
@@ -573,6 +577,10 @@ void updateCACertificates_App(void) {
         setCACertificates_TlsRequest(&d->prefs.strings[caFile_PrefsString],
                                      &d->prefs.strings[caPath_PrefsString]);
     }
+    if (d->certs) {
+        /* Previous chain verification results may no longer apply. */
+        resetVerified_GmCerts(d->certs);
+    }
 }
 
 static void loadPrefs_App_(iApp *d) {
@@ -875,6 +883,9 @@ static iBool loadState_App_(iApp *d) {
                     }
                 }
                 deserializeState_DocumentWidget(doc, stream_File(f));
+                if (doc) {
+                    d->hasDormantTabs = iTrue;
+                }
                 doc = NULL;
             }
             else {
@@ -907,6 +918,19 @@ static iBool loadState_App_(iApp *d) {
     return iFalse;
 }
 
+#if defined (LAGRANGE_ENABLE_IDLE_SLEEP)
+static void wakeUpDormantTab_App_(iApp *d) {
+    /* One tab at a time, so the app remains responsive. */
+    iForEach(ObjectList, i, iClob(listAllDocuments_App())) {
+        if (isDormant_DocumentWidget(i.object)) {
+            wakeUp_DocumentWidget(i.object);
+            return;
+        }
+    }
+    d->hasDormantTabs = iFalse;
+}
+#endif
+
 static void saveState_App_(const iApp *d, iBool withContent) {
     if (isAppleDesktop_Platform() && isEmpty_PtrArray(&d->mainWindows)) {
         return; /* nothing to save; keep what was saved earlier */
@@ -979,6 +1003,9 @@ static void saveState_App_(const iApp *d, iBool withContent) {
        before the state file is fully written. */
     commitFile_App(concatPath_CStr(dataDir_App_(), stateFileName_App_),
                    concatPath_CStr(dataDir_App_(), tempStateFileName_App_));
+    if (withContent) {
+        purgeContent_History(); /* bodies of closed tabs and pruned items */
+    }
 }
 
 void commitFile_App(const char *path, const char *tempPathWithNewContents) {
@@ -1417,6 +1444,7 @@ static void init_App_(iApp *d, int argc, char **argv) {
         postCommand_App("~bookmarks.changed");
     }
     init_Feeds(dataDir_App_());
+    setContentDir_History(concatPath_CStr(dataDir_App_(), contentDirName_App_));
     /* Widget state init. */
     processEvents_App(postedEventsOnly_AppEventMode);
     if (!loadState_App_(d)) {
@@ -1666,6 +1694,10 @@ const iString *debugInfo_App(void) {
         }
         appendFormat_String(msg, "Total cache: %.3f MB\n", total.cacheSize / 1.0e6f);
         appendFormat_String(msg, "Total memory: %.3f MB\n", total.memorySize / 1.0e6f);
+        const iGlyphCacheStats glyphs = glyphCacheStats_Text();
+        appendFormat_String(msg, "Glyph cache: %d/%d pages, %u hits, %u misses, %u evictions\n",
+                            glyphs.numPages, glyphs.maxPages,
+                            glyphs.hits, glyphs.misses, glyphs.evictions);
     }
     appendFormat_String(msg, "## Documents\n");
     iForEach(ObjectList, k, docs) {
@@ -1718,57 +1750,11 @@ iObjectList *listAllDocuments_App(void) {
 }
 
 void trimCache_App(void) {
-    iApp *d = &app_;
-    size_t cacheSize = 0;
-    const size_t limit = d->prefs.maxCacheSize * 1000000;
-    iObjectList *docs = listAllDocuments_App();
-    iForEach(ObjectList, i, docs) {
-        cacheSize += cacheSize_History(history_DocumentWidget(i.object));
-    }
-    init_ObjectListIterator(&i, docs);
-    iBool wasPruned = iFalse;
-    while (cacheSize > limit) {
-        iDocumentWidget *doc = i.object;
-        const size_t pruned = pruneLeastImportant_History(history_DocumentWidget(doc));
-        if (pruned) {
-            cacheSize -= pruned;
-            wasPruned = iTrue;
-        }
-        next_ObjectListIterator(&i);
-        if (!i.value) {
-            if (!wasPruned) break;
-            wasPruned = iFalse;
-            init_ObjectListIterator(&i, docs);
-        }
-    }
-    iRelease(docs);
+    pruneCache_History(app_.prefs.maxCacheSize * 1000000);
 }
 
 void trimMemory_App(void) {
-    iApp *d = &app_;
-    size_t memorySize = 0;
-    const size_t limit = d->prefs.maxMemorySize * 1000000;
-    iObjectList *docs = listAllDocuments_App();
-    iForEach(ObjectList, i, docs) {
-        memorySize += memorySize_History(history_DocumentWidget(i.object));
-    }
-    init_ObjectListIterator(&i, docs);
-    iBool wasPruned = iFalse;
-    while (memorySize > limit) {
-        iDocumentWidget *doc = i.object;
-        const size_t pruned = pruneLeastImportantMemory_History(history_DocumentWidget(doc));
-        if (pruned) {
-            memorySize -= pruned;
-            wasPruned = iTrue;
-        }
-        next_ObjectListIterator(&i);
-        if (!i.value) {
-            if (!wasPruned) break;
-            wasPruned = iFalse;
-            init_ObjectListIterator(&i, docs);
-        }
-    }
-    iRelease(docs);
+    pruneMemory_History(app_.prefs.maxMemorySize * 1000000);
 }
 
 void saveStateQuickly_App(void) {
@@ -2034,6 +2020,9 @@ void processEvents_App(enum iAppEventMode eventMode) {
 //                            fflush(stdout);
                         }
                         d->isIdling = iTrue;
+                        if (d->hasDormantTabs) {
+                            wakeUpDormantTab_App_(d);
+                        }
                     }
                     continue;
                 }
@@ -3454,15 +3443,7 @@ static iBool handleIdentityCreationCommands_(iWidget *dlg, const char *cmd) {
                 }
             }
             /* The input seems fine. */
-            iGmIdentity *ident = newIdentity_GmCerts(d->certs,
-                                                     isTemp ? temporary_GmIdentityFlag : 0,
-                                                     until,
-                                                     commonName,
-                                                     email,
-                                                     userId,
-                                                     domain,
-                                                     organization,
-                                                     country);
+            iString *useUrl = NULL;
             /* Use in the chosen scope. */ {
                 int         selScope = 0;
                 const char *scopeCmd =
@@ -3471,7 +3452,6 @@ static iBool handleIdentityCreationCommands_(iWidget *dlg, const char *cmd) {
                     selScope = arg_Command(scopeCmd);
                 }
                 const iString *docUrl = url_DocumentWidget(document_Root(dlg->root));
-                iString *useUrl = NULL;
                 switch (selScope) {
                     default: /* not used */
                         break;
@@ -3489,11 +3469,20 @@ static iBool handleIdentityCreationCommands_(iWidget *dlg, const char *cmd) {
                         useUrl = collect_String(copy_String(docUrl));
                         break;
                 }
-                if (useUrl) {
-                    signIn_GmCerts(d->certs, ident, useUrl);
-                    postCommand_App("navigate.reload");
-                }
             }
+            /* Key generation may take a while, so it is done in the background.
+               "ident.generated" is posted when the identity is ready. */
+            generateIdentity_GmCerts(d->certs,
+                                     isTemp ? temporary_GmIdentityFlag : 0,
+                                     until,
+                                     commonName,
+                                     email,
+                                     userId,
+                                     domain,
+                                     organization,
+                                     country,
+                                     useUrl);
+            /* The sidebar shows that the identity is pending. */
             postCommandf_App("sidebar.mode arg:%d show:1", identities_SidebarMode);
             postCommand_App("idents.changed");
         }
@@ -3921,6 +3910,12 @@ static iBool handleNonWindowRelatedCommand_App_(iApp *d, const char *cmd) {
         setRefreshInterval_Feeds(d->prefs.feedInterval);
         return iTrue;
     }
+    else if (equal_Command(cmd, "feedconcurrency.set")) {
+        /* Applied when the next refresh begins. */
+        d->prefs.feedConcurrency     = iClamp(arg_Command(cmd), 1, 32);
+        d->prefs.feedHostConcurrency = iClamp(argLabel_Command(cmd, "host"), 1, 8);
+        return iTrue;
+    }
     else if (equal_Command(cmd, "theme.set")) {
         const int isAuto = argLabel_Command(cmd, "auto");
         d->prefs.theme = arg_Command(cmd);
@@ -4161,6 +4156,10 @@ static iBool handleNonWindowRelatedCommand_App_(iApp *d, const char *cmd) {
         refresh_Feeds();
         return iTrue;
     }
+    else if (equal_Command(cmd, "certs.trust.changed")) {
+        saveTrusted_GmCerts(d->certs);
+        return iFalse;
+    }
     else if (equal_Command(cmd, "visited.changed")) {
         /* The visited file can grow large, so don't keep rewriting it after every navigation. */
         const uint32_t now = SDL_GetTicks();
@@ -4175,6 +4174,15 @@ static iBool handleNonWindowRelatedCommand_App_(iApp *d, const char *cmd) {
         saveIdentities_GmCerts(d->certs);
         return iFalse;
     }
+    else if (equal_Command(cmd, "ident.generated")) {
+        iGmIdentity *ident = finishIdentity_GmCerts(d->certs, argU32Label_Command(cmd, "id"));
+        if (ident && isUsed_GmIdentity(ident)) {
+            postCommand_App("navigate.reload");
+        }
+        /* Also clears the pending state if the generation failed. */
+        postCommand_App("idents.changed");
+        return iTrue;
+    }
     else if (equal_Command(cmd, "ident.signin")) {
         const iString *url = collect_String(suffix_Command(cmd, "url"));
         signIn_GmCerts(
@@ -5047,6 +5055,7 @@ iBool handleCommand_App(const char *cmd) {
         const uint32_t bmId = argLabel_Command(cmd, "bmid");
         const uint32_t destFolder = arg_Command(cmd);
         get_Bookmarks(bookmarks_App(), bmId)->parentId = destFolder;
+        invalidate_Bookmarks(d->bookmarks);
         postCommand_App("bookmarks.changed");
         return iTrue;
     }
@@ -5079,6 +5088,10 @@ iBool handleCommand_App(const char *cmd) {
         }
         return iTrue;
     }
+    else if (equal_Command(cmd, "feeds.update.loaded")) {
+        loadFinished_Feeds();
+        return iFalse;
+    }
     else if (startsWith_CStr(cmd, "feeds.update.")) {
         const iWidget *navBar = findChild_Widget(get_Window()->roots[0]->widget, "navbar");
         iAnyObject *prog = findChild_Widget(navBar, "feeds.progress");
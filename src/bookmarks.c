@@ -23,6 +23,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "bookmarks.h"
 #include "gmrequest.h"
 #include "app.h"
+#include "trigramindex.h"
 
 #include <the_Foundation/file.h>
 #include <the_Foundation/hash.h>
@@ -31,6 +32,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/stringset.h>
 #include <the_Foundation/toml.h>
+#include <ctype.h>
 
 void init_Bookmark(iBookmark *d) {
     init_String(&d->url);
@@ -158,22 +160,226 @@ static const char *oldFileName_Bookmarks_  = "bookmarks.txt";
 static const char *fileName_Bookmarks_     = "bookmarks.ini"; /* since v1.7 (TOML subset) */
 static const char *tempFileName_Bookmarks_ = "bookmarks.ini.tmp";
 
+iDeclareType(BookmarkKey)
+
+struct Impl_BookmarkKey {
+    iHashNode     node; /* key is a hash of the URL and identity, or of the URL root */
+    uint32_t      bookmarkId;
+    iBookmarkKey *next; /* another bookmark with the same key */
+};
+
+/* Copies of all the bookmarks, for reading in other threads without holding the mutex. */
+iDeclareClass(BookmarksSnapshot)
+
+struct Impl_BookmarksSnapshot {
+    iObject       object;
+    iHash         bookmarks; /* bookmark ID is the hash key */
+    iTrigramIndex textIndex; /* bookmark IDs by trigrams of the title, URL, and tags */
+};
+
+void init_BookmarksSnapshot(iBookmarksSnapshot *d) {
+    init_Hash(&d->bookmarks);
+    init_TrigramIndex(&d->textIndex);
+}
+
+void deinit_BookmarksSnapshot(iBookmarksSnapshot *d) {
+    deinit_TrigramIndex(&d->textIndex);
+    iForEach(Hash, i, &d->bookmarks) {
+        delete_Bookmark((iBookmark *) i.value);
+    }
+    deinit_Hash(&d->bookmarks);
+}
+
+iDefineObjectConstruction(BookmarksSnapshot)
+iDefineClass(BookmarksSnapshot)
+
+static iBookmark *newCopy_Bookmark_(const iBookmark *d) {
+    /* Strings are copied in full so no data is shared with the original. */
+    iBookmark *copy = new_Bookmark();
+    copy->node.key  = d->node.key;
+    setRange_String(&copy->url, range_String(&d->url));
+    setRange_String(&copy->title, range_String(&d->title));
+    setRange_String(&copy->tags, range_String(&d->tags));
+    setRange_String(&copy->notes, range_String(&d->notes));
+    setRange_String(&copy->identity, range_String(&d->identity));
+    copy->flags    = d->flags;
+    copy->icon     = d->icon;
+    copy->when     = d->when;
+    copy->parentId = d->parentId;
+    copy->order    = d->order;
+    return copy;
+}
+
+const iBookmark *get_BookmarksSnapshot(const iBookmarksSnapshot *d, uint32_t id) {
+    return (const iBookmark *) value_Hash(&d->bookmarks, id);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
 struct Impl_Bookmarks {
     iMutex *  mtx;
     int       idEnum;
     iHash     bookmarks; /* bookmark ID is the hash key */
     uint32_t  recentFolderId; /* recently interacted with */
     iPtrArray remoteRequests;
+    iHash     urlIndex;  /* BookmarkKeys for finding bookmarks by URL and identity */
+    iHash     rootIndex; /* BookmarkKeys of bookmarks with a user icon, by URL root */
+    iBool     isIndexValid;
+    iBookmarksSnapshot *snapshot; /* released whenever bookmarks are added, removed, or edited */
 };
 
 iDefineTypeConstruction(Bookmarks)
 
+static uint32_t hashCase_(uint32_t hash, iRangecc text) {
+    /* FNV-1a of the lowercase characters. */
+    for (const char *ch = text.start; ch < text.end; ch++) {
+        hash = (hash ^ (uint8_t) tolower(*ch)) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t urlKey_Bookmarks_(const iString *url, const iString *identFp) {
+    uint32_t hash = hashCase_(2166136261u, range_String(url));
+    if (identFp) {
+        hash = hash * 31 + iCrc32(cstr_String(identFp), size_String(identFp));
+    }
+    return hash;
+}
+
+static uint32_t rootKey_Bookmarks_(iRangecc urlRoot) {
+    return hashCase_(2166136261u, urlRoot);
+}
+
+static iBool hasRootIcon_Bookmark_(const iBookmark *d) {
+    return d->icon && d->flags & userIcon_BookmarkFlag;
+}
+
+static void insertKey_(iHash *index, uint32_t key, uint32_t bookmarkId) {
+    iBookmarkKey *bk = iMalloc(BookmarkKey);
+    bk->node.key   = key;
+    bk->bookmarkId = bookmarkId;
+    bk->next       = NULL;
+    iBookmarkKey *head = (iBookmarkKey *) value_Hash(index, key);
+    if (head) {
+        bk->next   = head->next;
+        head->next = bk;
+    }
+    else {
+        insert_Hash(index, &bk->node);
+    }
+}
+
+static void removeKey_(iHash *index, uint32_t key, uint32_t bookmarkId) {
+    iBookmarkKey *head = (iBookmarkKey *) value_Hash(index, key);
+    if (!head) {
+        return;
+    }
+    if (head->bookmarkId == bookmarkId) {
+        remove_Hash(index, key);
+        if (head->next) {
+            insert_Hash(index, &head->next->node);
+        }
+        free(head);
+        return;
+    }
+    for (iBookmarkKey *prev = head; prev->next; prev = prev->next) {
+        if (prev->next->bookmarkId == bookmarkId) {
+            iBookmarkKey *bk = prev->next;
+            prev->next = bk->next;
+            free(bk);
+            return;
+        }
+    }
+}
+
+static void clearIndex_(iHash *index) {
+    iForEach(Hash, i, index) {
+        iBookmarkKey *bk = (iBookmarkKey *) i.value;
+        remove_HashIterator(&i);
+        while (bk) {
+            iBookmarkKey *next = bk->next;
+            free(bk);
+            bk = next;
+        }
+    }
+}
+
+static void invalidateSnapshot_Bookmarks_(iBookmarks *d) {
+    /* Caller must hold the mutex. Readers keep their own references to the old copy. */
+    if (d->snapshot) {
+        iRelease(d->snapshot);
+        d->snapshot = NULL;
+    }
+}
+
+static iBookmarksSnapshot *snapshot_Bookmarks_(iBookmarks *d) {
+    /* Caller must hold the mutex. The text index is built from the copies, so searching it
+       never touches the bookmarks that are being edited. */
+    if (!d->snapshot) {
+        iBookmarksSnapshot *snap = new_BookmarksSnapshot();
+        iConstForEach(Hash, i, &d->bookmarks) {
+            iBookmark *copy = newCopy_Bookmark_((const iBookmark *) i.value);
+            insert_Hash(&snap->bookmarks, &copy->node);
+            if (!isFolder_Bookmark(copy)) {
+                add_TrigramIndex(&snap->textIndex, id_Bookmark(copy), range_String(&copy->title));
+                add_TrigramIndex(&snap->textIndex, id_Bookmark(copy), range_String(&copy->url));
+                add_TrigramIndex(&snap->textIndex, id_Bookmark(copy), range_String(&copy->tags));
+            }
+        }
+        d->snapshot = snap;
+    }
+    return d->snapshot;
+}
+
+static void index_Bookmarks_(iBookmarks *d, const iBookmark *bm) {
+    /* Caller must hold the mutex. */
+    invalidateSnapshot_Bookmarks_(d);
+    if (!d->isIndexValid || isFolder_Bookmark(bm)) {
+        return;
+    }
+    insertKey_(&d->urlIndex, urlKey_Bookmarks_(&bm->url, &bm->identity), id_Bookmark(bm));
+    if (hasRootIcon_Bookmark_(bm)) {
+        insertKey_(&d->rootIndex, rootKey_Bookmarks_(urlRoot_String(&bm->url)), id_Bookmark(bm));
+    }
+}
+
+static void unindex_Bookmarks_(iBookmarks *d, const iBookmark *bm) {
+    /* Caller must hold the mutex. The bookmark must not have been edited since it was indexed;
+       otherwise, `invalidate_Bookmarks` must have been called. */
+    invalidateSnapshot_Bookmarks_(d);
+    if (!d->isIndexValid || isFolder_Bookmark(bm)) {
+        return;
+    }
+    removeKey_(&d->urlIndex, urlKey_Bookmarks_(&bm->url, &bm->identity), id_Bookmark(bm));
+    if (hasRootIcon_Bookmark_(bm)) {
+        removeKey_(&d->rootIndex, rootKey_Bookmarks_(urlRoot_String(&bm->url)), id_Bookmark(bm));
+    }
+}
+
+static void validateIndex_Bookmarks_(iBookmarks *d) {
+    /* Caller must hold the mutex. */
+    if (d->isIndexValid) {
+        return;
+    }
+    clearIndex_(&d->urlIndex);
+    clearIndex_(&d->rootIndex);
+    invalidateSnapshot_Bookmarks_(d);
+    d->isIndexValid = iTrue;
+    iConstForEach(Hash, i, &d->bookmarks) {
+        index_Bookmarks_(d, (const iBookmark *) i.value);
+    }
+}
+
 void init_Bookmarks(iBookmarks *d) {
     d->mtx = new_Mutex();
     d->idEnum = 0;
     init_Hash(&d->bookmarks);
     d->recentFolderId = 0;
     init_PtrArray(&d->remoteRequests);
+    init_Hash(&d->urlIndex);
+    init_Hash(&d->rootIndex);
+    d->isIndexValid = iTrue;
+    d->snapshot = NULL;
 }
 
 void deinit_Bookmarks(iBookmarks *d) {
@@ -185,6 +391,8 @@ void deinit_Bookmarks(iBookmarks *d) {
     deinit_PtrArray(&d->remoteRequests);
     clear_Bookmarks(d);
     deinit_Hash(&d->bookmarks);
+    deinit_Hash(&d->rootIndex);
+    deinit_Hash(&d->urlIndex);
     delete_Mutex(d->mtx);
 }
 
@@ -194,6 +402,10 @@ void clear_Bookmarks(iBookmarks *d) {
         delete_Bookmark((iBookmark *) i.value);
     }
     clear_Hash(&d->bookmarks);
+    clearIndex_(&d->urlIndex);
+    clearIndex_(&d->rootIndex);
+    invalidateSnapshot_Bookmarks_(d);
+    d->isIndexValid = iTrue;
     d->idEnum = 0;
     unlock_Mutex(d->mtx);
 }
@@ -201,6 +413,7 @@ void clear_Bookmarks(iBookmarks *d) {
 static void insertId_Bookmarks_(iBookmarks *d, iBookmark *bookmark, int id) {
     bookmark->node.key = id;
     insert_Hash(&d->bookmarks, &bookmark->node);
+    index_Bookmarks_(d, bookmark);
 }
 
 static void insert_Bookmarks_(iBookmarks *d, iBookmark *bookmark) {
@@ -381,6 +594,7 @@ void sort_Bookmarks(iBookmarks *d, uint32_t parentId, iBookmarksCompareFunc cmp)
         iBookmark *bm = i.ptr;
         bm->order = index_PtrArrayConstIterator(&i) + 1;
     }
+    invalidateSnapshot_Bookmarks_(d);
     unlock_Mutex(d->mtx);
 }
 
@@ -557,8 +771,10 @@ iBool remove_Bookmarks(iBookmarks *d, uint32_t id) {
     if (bm) {
         /* Remove all the contained bookmarks as well. */
         iConstForEach(PtrArray, i, list_Bookmarks(d, NULL, filterInsideFolder_Bookmark, bm)) {
+            unindex_Bookmarks_(d, i.ptr);
             delete_Bookmark((iBookmark *) remove_Hash(&d->bookmarks, id_Bookmark(i.ptr)));
         }
+        unindex_Bookmarks_(d, bm);
         delete_Bookmark(bm);
     }
     unlock_Mutex(d->mtx);
@@ -577,10 +793,21 @@ iBool updateBookmarkIcon_Bookmarks(iBookmarks *d, const iString *url, iChar icon
             }
         }
     }
+    if (changed) {
+        invalidateSnapshot_Bookmarks_(d);
+    }
     unlock_Mutex(d->mtx);
     return changed;
 }
 
+void invalidate_Bookmarks(iBookmarks *d) {
+    /* The indexes and the snapshot will be rebuilt when next needed. */
+    iGuardMutex(d->mtx, {
+        d->isIndexValid = iFalse;
+        invalidateSnapshot_Bookmarks_(d);
+    });
+}
+
 void setRecentFolder_Bookmarks(iBookmarks *d, uint32_t folderId) {
     iBookmark *bm = get_Bookmarks(d, folderId);
     if (bm && isFolder_Bookmark(bm)) {
@@ -599,9 +826,13 @@ iChar siteIcon_Bookmarks(const iBookmarks *d, const iString *url) {
     size_t         matchingSize = iInvalidSize; /* we'll pick the shortest matching */
     iChar          icon         = 0;
     lock_Mutex(d->mtx);
-    iConstForEach(Hash, i, &d->bookmarks) {
-        const iBookmark *bm = (const iBookmark *) i.value;
-        if (bm->icon && bm->flags & userIcon_BookmarkFlag) {
+    validateIndex_Bookmarks_(iConstCast(iBookmarks *, d));
+    for (const iBookmarkKey *bk = (const iBookmarkKey *) value_Hash(&d->rootIndex,
+                                                                     rootKey_Bookmarks_(urlRoot));
+         bk;
+         bk = bk->next) {
+        const iBookmark *bm = (const iBookmark *) value_Hash(&d->bookmarks, bk->bookmarkId);
+        if (bm && hasRootIcon_Bookmark_(bm)) {
             const iRangecc bmRoot = urlRoot_String(&bm->url);
             if (equalRangeCase_Rangecc(urlRoot, bmRoot)) {
                 const size_t n = size_String(&bm->url);
@@ -631,6 +862,7 @@ void reorder_Bookmarks(iBookmarks *d, uint32_t id, int newOrder) {
             bm->order++;
         }
     }
+    invalidateSnapshot_Bookmarks_(d);
     unlock_Mutex(d->mtx);
 }
 
@@ -664,13 +896,22 @@ static iBool matchUrlAndIdent_(iMatchUrlArgs *args, const iBookmark *bm) {
 
 uint32_t findUrlIdent_Bookmarks(const iBookmarks *d, const iString *url, const iString *identFp) {
     iMatchUrlArgs args = { .url = canonicalUrl_String(url), .identityFp = identFp };
-    /* TODO: O(n), boo */
-    const iPtrArray *found =
-        list_Bookmarks(d, NULL, (iBookmarksFilterFunc) matchUrlAndIdent_, &args);
-    if (isEmpty_PtrArray(found)) {
-        return 0;
+    /* A missing identity is the same as an empty one. */
+    const uint32_t key = urlKey_Bookmarks_(args.url, identFp ? identFp : collectNew_String());
+    const iBookmark *found = NULL;
+    lock_Mutex(d->mtx);
+    validateIndex_Bookmarks_(iConstCast(iBookmarks *, d));
+    for (const iBookmarkKey *bk = (const iBookmarkKey *) value_Hash(&d->urlIndex, key); bk;
+         bk = bk->next) {
+        const iBookmark *bm = (const iBookmark *) value_Hash(&d->bookmarks, bk->bookmarkId);
+        /* The most recently created one is preferred. */
+        if (bm && matchUrlAndIdent_(&args, bm) &&
+            (!found || cmpTimeDescending_Bookmark_(&bm, &found) < 0)) {
+            found = bm;
+        }
     }
-    return id_Bookmark(constFront_PtrArray(found));
+    unlock_Mutex(d->mtx);
+    return found ? id_Bookmark(found) : 0;
 }
 
 /*----------------------------------------------------------------------------------------------*/
@@ -695,6 +936,51 @@ const iPtrArray *list_Bookmarks(const iBookmarks *d, iBookmarksCompareFunc cmp,
     return list;
 }
 
+const iBookmarksSnapshot *snapshot_Bookmarks(const iBookmarks *d) {
+    iBookmarksSnapshot *snap;
+    iGuardMutex(d->mtx, snap = ref_Object(snapshot_Bookmarks_(iConstCast(iBookmarks *, d))));
+    return iClob(snap);
+}
+
+static const iPtrArray *sorted_Bookmarks_(iPtrArray *list, iBookmarksCompareFunc cmp) {
+    if (!cmp) cmp = cmpTimeDescending_Bookmark_;
+    sort_Array(list, (int (*)(const void *, const void *)) cmp);
+    return list;
+}
+
+const iPtrArray *list_BookmarksSnapshot(const iBookmarksSnapshot *d, iBookmarksCompareFunc cmp,
+                                        iBookmarksFilterFunc filter, void *context) {
+    iPtrArray *list = collectNew_PtrArray();
+    iConstForEach(Hash, i, &d->bookmarks) {
+        const iBookmark *bm = (const iBookmark *) i.value;
+        if (!filter || filter(context, bm)) {
+            pushBack_PtrArray(list, bm);
+        }
+    }
+    return sorted_Bookmarks_(list, cmp);
+}
+
+const iPtrArray *listMatching_BookmarksSnapshot(const iBookmarksSnapshot *d, const iString *term,
+                                                iBookmarksCompareFunc cmp,
+                                                iBookmarksFilterFunc filter, void *context) {
+    iIntSet ids;
+    init_IntSet(&ids);
+    if (!query_TrigramIndex(&d->textIndex, term, &ids)) {
+        /* The term is too short to narrow down the search. */
+        deinit_IntSet(&ids);
+        return list_BookmarksSnapshot(d, cmp, filter, context);
+    }
+    iPtrArray *list = collectNew_PtrArray();
+    iConstForEach(IntSet, i, &ids) {
+        const iBookmark *bm = get_BookmarksSnapshot(d, *i.value);
+        if (bm && (!filter || filter(context, bm))) {
+            pushBack_PtrArray(list, bm);
+        }
+    }
+    deinit_IntSet(&ids);
+    return sorted_Bookmarks_(list, cmp);
+}
+
 size_t count_Bookmarks(const iBookmarks *d) {
     size_t n = 0;
     iConstForEach(Hash, i, &d->bookmarks) {
@@ -860,6 +1146,7 @@ void requestFinished_Bookmarks(iBookmarks *d, iGmRequest *req) {
         }
         deinit_String(&src);
         iRelease(linkPattern);
+        invalidate_Bookmarks(d); /* flags and parents were set in place */
     }
     else {
         /* TODO: Show error? */
@@ -881,6 +1168,7 @@ void fetchRemote_Bookmarks(iBookmarks *d) {
         iForEach(Hash, i, &d->bookmarks) {
             iBookmark *bm = (iBookmark *) i.value;
             if (bm->flags & remote_BookmarkFlag) {
+                unindex_Bookmarks_(d, bm);
                 remove_HashIterator(&i);
                 delete_Bookmark(bm);
                 numRemoved++;
@@ -76,6 +76,7 @@ iBool   filterInsideFolder_Bookmark     (void *parentFolder, const iBookmark *);
 
 iDeclareType(Bookmarks)
 iDeclareTypeConstruction(Bookmarks)
+iDeclareType(BookmarksSnapshot)
 
 typedef iBool (*iBookmarksFilterFunc)   (void *context, const iBookmark *);
 typedef int   (*iBookmarksCompareFunc)  (const iBookmark **, const iBookmark **);
@@ -95,13 +96,14 @@ iBookmark * get_Bookmarks               (iBookmarks *, uint32_t id);
 void        reorder_Bookmarks           (iBookmarks *, uint32_t id, int newOrder);
 iBool       updateBookmarkIcon_Bookmarks(iBookmarks *, const iString *url, iChar icon);
 void        setRecentFolder_Bookmarks   (iBookmarks *, uint32_t folderId);
+void        invalidate_Bookmarks        (iBookmarks *); /* after editing any bookmark in place */
 void        sort_Bookmarks              (iBookmarks *, uint32_t parentId, iBookmarksCompareFunc cmp);
 void        fetchRemote_Bookmarks       (iBookmarks *);
 void        requestFinished_Bookmarks   (iBookmarks *, iGmRequest *req);
 
 iChar       siteIcon_Bookmarks          (const iBookmarks *, const iString *url);
-uint32_t    findUrl_Bookmarks           (const iBookmarks *, const iString *url); /* O(n) */
-uint32_t    findUrlIdent_Bookmarks      (const iBookmarks *, const iString *url, const iString *identFp); /* O(n) */
+uint32_t    findUrl_Bookmarks           (const iBookmarks *, const iString *url);
+uint32_t    findUrlIdent_Bookmarks      (const iBookmarks *, const iString *url, const iString *identFp);
 uint32_t    recentFolder_Bookmarks      (const iBookmarks *);
 
 //iBool   filterTagsRegExp_Bookmarks      (void *regExp, const iBookmark *);
@@ -121,6 +123,26 @@ iBool       filterHomepage_Bookmark     (void *, const iBookmark *);
 const iPtrArray *list_Bookmarks(const iBookmarks *, iBookmarksCompareFunc cmp,
                                 iBookmarksFilterFunc filter, void *context);
 
+/**
+ * Immutable copy of all the bookmarks. A snapshot can be read in any thread without locking,
+ * and it remains valid even if bookmarks are edited or deleted in the meantime.
+ *
+ * Must be called in the main thread, because bookmarks are edited in place there and a new
+ * snapshot is copied from them. Other threads should be handed a snapshot.
+ *
+ * @return Collected reference to the latest snapshot. A new one is made only after the
+ * bookmarks have changed.
+ */
+const iBookmarksSnapshot *snapshot_Bookmarks(const iBookmarks *);
+
+const iBookmark *get_BookmarksSnapshot  (const iBookmarksSnapshot *, uint32_t id);
+const iPtrArray *list_BookmarksSnapshot (const iBookmarksSnapshot *, iBookmarksCompareFunc cmp,
+                                         iBookmarksFilterFunc filter, void *context);
+/* Lists the bookmarks that may contain the words of `term`, narrowed down with an index. */
+const iPtrArray *listMatching_BookmarksSnapshot(const iBookmarksSnapshot *, const iString *term,
+                                                iBookmarksCompareFunc cmp,
+                                                iBookmarksFilterFunc filter, void *context);
+
 enum iBookmarkListType {
     listByFolder_BookmarkListType,
     listByTag_BookmarkListType,
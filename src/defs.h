@@ -113,9 +113,14 @@ enum iFileVersion {
     responseIdentity_FileVersion        = 8,
     recentUrlSetIdentity_FileVersion    = 9,
     recentlySubmittedInput_FileVersion  = 10,
+    compressedCache_FileVersion         = 11,
+    storedContent_FileVersion           = 12,
+    dormantTabTitle_FileVersion         = 13,
+    contentChecksum_FileVersion         = 14,
     /* meta */
-    latest_FileVersion = 10, /* used by state.lgr */
+    latest_FileVersion = 14, /* used by state.lgr */
     idents_FileVersion = 1, /* used by GmCerts/idents.lgr */
+    feeds_FileVersion  = 1, /* used by Feeds/feeds.lgr */
 };
 
 enum iImageStyle {
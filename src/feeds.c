@@ -26,14 +26,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "visited.h"
 #include "lang.h"
 #include "app.h"
+#include "trigramindex.h"
 
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/hash.h>
 #include <the_Foundation/intset.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/queue.h>
-#include <the_Foundation/regexp.h>
 #include <the_Foundation/stringset.h>
 #include <the_Foundation/thread.h>
 #include <SDL_timer.h>
@@ -50,6 +51,7 @@ void init_FeedEntry(iFeedEntry *d) {
     init_String(&d->url);
     init_String(&d->title);
     d->bookmarkId = 0;
+    d->textId = 0;
     d->isHeading = iFalse;
 }
 
@@ -83,6 +85,7 @@ static int requestTimeoutSeconds_FeedJob_ = 10.0f;
 
 struct Impl_FeedJob {
     iString     url;
+    iString     host; /* for limiting concurrent requests per server */
     uint32_t    bookmarkId;
     iTime       startTime;
     iBool       isFirstUpdate; /* hasn't been checked ever before */
@@ -91,14 +94,27 @@ struct Impl_FeedJob {
     iGmRequest *request;
     int         numRedirect;
     iPtrArray   results;
+    iString     baseRoot; /* scheme and authority of the feed page */
+    iString     baseDir; /* feed page URL up to the last slash */
+    iString     linkUrl; /* scratch buffer for resolving entry URLs */
+    uint32_t    bodyHash; /* zero if the request failed */
+    iBool       isUnchanged; /* body identical to the previously parsed one */
+    double      parseSeconds;
 };
 
 static void init_FeedJob(iFeedJob *d, const iBookmark *bookmark) {
     initCopy_String(&d->url, &bookmark->url);
+    initRange_String(&d->host, urlHost_String(&d->url));
     d->bookmarkId = id_Bookmark(bookmark);
     d->request = NULL;
     d->numRedirect = 0;
     init_PtrArray(&d->results);
+    init_String(&d->baseRoot);
+    init_String(&d->baseDir);
+    init_String(&d->linkUrl);
+    d->bodyHash = 0;
+    d->isUnchanged = iFalse;
+    d->parseSeconds = 0.0;
     iZap(d->startTime);
     d->isFirstUpdate = iFalse;
     d->checkHeadings = (bookmark->flags & headings_BookmarkFlag) != 0;
@@ -111,6 +127,10 @@ static void deinit_FeedJob(iFeedJob *d) {
         delete_FeedEntry(i.ptr);
     }
     deinit_PtrArray(&d->results);
+    deinit_String(&d->linkUrl);
+    deinit_String(&d->baseDir);
+    deinit_String(&d->baseRoot);
+    deinit_String(&d->host);
     deinit_String(&d->url);
 }
 
@@ -118,11 +138,42 @@ static iBool isTimedOut_FeedJob_(iFeedJob *d) {
     return elapsedSeconds_Time(&d->startTime) > requestTimeoutSeconds_FeedJob_;
 }
 
+static uint32_t bodyHash_FeedJob_(iFeedJob *d) {
+    /* The final URL and the parsing options affect the results, too. */
+    const iBlock *body = &lockResponse_GmRequest(d->request)->body;
+    uint32_t hash = iCrc32(constData_Block(body), size_Block(body));
+    unlockResponse_GmRequest(d->request);
+    const iString *url = url_GmRequest(d->request);
+    hash = hash * 31 + iCrc32(cstr_String(url), size_String(url));
+    hash = hash * 31 + (d->checkHeadings ? 0x1 : 0) + (d->ignoreWeb ? 0x2 : 0);
+    return hash ? hash : 1;
+}
+
 iDefineTypeConstructionArgs(FeedJob, (const iBookmark *bm), bm)
 
 /*----------------------------------------------------------------------------------------------*/
 
-static const char *feedsFilename_Feeds_ = "feeds.txt";
+static const char *feedsFilename_Feeds_     = "feeds.lgr";
+static const char *tempFeedsFilename_Feeds_ = "feeds.lgr.tmp";
+static const char *oldFeedsFilename_Feeds_  = "feeds.txt";
+
+static const char *magicFeeds_Feeds_   = "lgF1";
+static const char *magicTime_Feeds_    = "time";
+static const char *magicFeed_Feeds_    = "feed";
+static const char *magicSource_Feeds_  = "srce";
+static const char *magicEntry_Feeds_   = "entr";
+static const char *magicRemoved_Feeds_ = "rmvd";
+static const char *magicSeen_Feeds_    = "seen";
+
+iDeclareType(FeedSource)
+
+struct Impl_FeedSource {
+    iHashNode node;        /* key is the bookmark ID */
+    uint32_t  bodyHash;    /* last parsed response */
+    iTime     mergedAt;    /* entries were last updated from a parsed response */
+    uint32_t  parseMicros; /* duration of the last parse */
+    uint32_t  mergeMicros; /* duration of the last merge into the entry database */
+};
 
 struct Impl_Feeds {
     iMutex *  mtx;
@@ -132,22 +183,137 @@ struct Impl_Feeds {
     int       refreshTimer;
     uint32_t  refreshInterval; /* milliseconds, for refreshTimer */
     iThread * worker;
+    const iBookmarksSnapshot *subscriptions; /* taken in the main thread for the worker */
     iBool     stopWorker;
+    iCondition wakeup; /* signaled when a request finishes or the worker should stop */
+    iBool     isWakeupPending;
+    int       maxConcurrent;
+    int       maxConcurrentPerHost;
     iPtrArray jobs; /* pending */
     iSortedArray entries; /* pointers to all discovered feed entries, sorted by entry ID (URL) */
+    iSortedArray byTime; /* the same entries, newest first */
+    iTrigramIndex textIndex; /* text slots by trigrams of the entry title and URL */
+    iPtrArray textSlots; /* FeedEntries by `textId` minus one; NULL if the slot is free */
+    iArray    freeTextSlots;
+    iBool     isTextIndexValid; /* built when first searched */
+    size_t    numUnread; /* cached result of `numUnread_Feeds` */
+    uint32_t  numUnreadVisitedGen; /* Visited generation when `numUnread` was counted */
+    iBool     isNumUnreadValid;
+    iHash *   sources; /* FeedSource nodes for each subscribed bookmark */
+    iThread * loader;
+    iBool     isLoaded;
+    iBuffer * log; /* entry records not yet appended to the database file */
+    size_t    numLogged; /* records in `log` */
+    size_t    numAppended; /* records appended to the database file since it was compacted */
+    iBool     needCompaction;
 };
 
 static iFeeds feeds_;
 
-#define maxConcurrentRequests_Feeds 4
-
 static iBool isInitialized_Feeds_(const iFeeds *d) {
     return d->mtx != NULL;
 }
 
+static int cmp_FeedEntryPtr_(const void *a, const void *b) {
+    const iFeedEntry * const *elem[2] = { a, b };
+    const int cmp = cmpString_String(&(*elem[0])->url, &(*elem[1])->url);
+    if (cmp == 0) {
+        /* The same URL can be coming from different feeds. */
+        return iCmp((*elem[0])->bookmarkId, (*elem[1])->bookmarkId);
+    }
+    return cmp;
+}
+
+static int cmpTimeDescending_FeedEntryPtr_(const void *a, const void *b) {
+    const iFeedEntry * const *e1 = a, * const *e2 = b;
+    const int cmpPosted = -cmp_Time(&(*e1)->posted, &(*e2)->posted);
+    if (cmpPosted) return cmpPosted;
+    /* Posting timestamps may only be accurate to a day, so also sort by discovery time. */
+    const int cmpDiscovered = -cmp_Time(&(*e1)->discovered, &(*e2)->discovered);
+    if (cmpDiscovered) return cmpDiscovered;
+    /* Each entry needs a unique position in the time index. */
+    return cmp_FeedEntryPtr_(a, b);
+}
+
+static void indexText_Feeds_(iFeeds *d, iFeedEntry *entry) {
+    /* Caller must hold the mutex. */
+    size_t slot;
+    if (!isEmpty_Array(&d->freeTextSlots)) {
+        slot = *(const uint32_t *) back_Array(&d->freeTextSlots);
+        popBack_Array(&d->freeTextSlots);
+        set_PtrArray(&d->textSlots, slot, entry);
+    }
+    else {
+        slot = size_PtrArray(&d->textSlots);
+        pushBack_PtrArray(&d->textSlots, entry);
+    }
+    entry->textId = (uint32_t) slot + 1;
+    add_TrigramIndex(&d->textIndex, (uint32_t) slot, range_String(&entry->title));
+    add_TrigramIndex(&d->textIndex, (uint32_t) slot, range_String(&entry->url));
+}
+
+static void unindexText_Feeds_(iFeeds *d, iFeedEntry *entry) {
+    /* Caller must hold the mutex. */
+    if (!d->isTextIndexValid || !entry->textId) {
+        return;
+    }
+    const uint32_t slot = entry->textId - 1;
+    remove_TrigramIndex(&d->textIndex, slot, range_String(&entry->title));
+    remove_TrigramIndex(&d->textIndex, slot, range_String(&entry->url));
+    set_PtrArray(&d->textSlots, slot, NULL);
+    pushBack_Array(&d->freeTextSlots, &slot);
+    entry->textId = 0;
+}
+
+static void validateTextIndex_Feeds_(iFeeds *d) {
+    /* Caller must hold the mutex. After this, the index is updated as entries change. */
+    if (d->isTextIndexValid) {
+        return;
+    }
+    clear_TrigramIndex(&d->textIndex);
+    clear_PtrArray(&d->textSlots);
+    clear_Array(&d->freeTextSlots);
+    iForEach(Array, i, &d->entries.values) {
+        indexText_Feeds_(d, *(iFeedEntry **) i.value);
+    }
+    d->isTextIndexValid = iTrue;
+}
+
+static void index_Feeds_(iFeeds *d, iFeedEntry *entry) {
+    /* Caller must hold the mutex. */
+    insert_SortedArray(&d->byTime, &entry);
+    if (d->isTextIndexValid) {
+        indexText_Feeds_(d, entry);
+    }
+    d->isNumUnreadValid = iFalse;
+}
+
+static void unindex_Feeds_(iFeeds *d, iFeedEntry *entry) {
+    /* Caller must hold the mutex. Must be called before the entry's timestamps or title
+       are changed. */
+    size_t pos;
+    if (locate_SortedArray(&d->byTime, &entry, &pos)) {
+        remove_Array(&d->byTime.values, pos);
+    }
+    unindexText_Feeds_(d, entry);
+    d->isNumUnreadValid = iFalse;
+}
+
+static void requestFinished_Feeds_(iAnyObject *obj, iGmRequest *req) {
+    /* Called in the request's thread. */
+    iFeeds *d = obj;
+    iUnused(req);
+    iGuardMutex(d->mtx, {
+        d->isWakeupPending = iTrue;
+        signal_Condition(&d->wakeup);
+    });
+}
+
 static void submit_FeedJob_(iFeedJob *d) {
     d->request = new_GmRequest(certs_App());
     setUrl_GmRequest(d->request, &d->url);
+    setRange_String(&d->host, urlHost_String(&d->url));
+    iConnect(GmRequest, d->request, finished, &feeds_, requestFinished_Feeds_);
     initCurrent_Time(&d->startTime);
     submit_GmRequest(d->request);
 }
@@ -157,18 +323,71 @@ static iBool isSubscribed_(void *context, const iBookmark *bm) {
     return (bm->flags & subscribed_BookmarkFlag) != 0;
 }
 
-static const iPtrArray *listSubscriptions_(void) {
-    return list_Bookmarks(bookmarks_App(), NULL, isSubscribed_, NULL);
+static const iPtrArray *listSubscriptions_(const iBookmarksSnapshot *bookmarks) {
+    /* The worker can't take snapshots of its own because bookmarks are edited in place in
+       the main thread. It uses the one taken when the refresh was started. */
+    return list_BookmarksSnapshot(bookmarks, NULL, isSubscribed_, NULL);
+}
+
+static iFeedSource *source_Feeds_(iFeeds *d, uint32_t bookmarkId) {
+    /* Caller must hold the mutex. */
+    iFeedSource *src = (iFeedSource *) value_Hash(d->sources, bookmarkId);
+    if (!src) {
+        src = iMalloc(FeedSource);
+        iZap(*src);
+        src->node.key = bookmarkId;
+        insert_Hash(d->sources, &src->node);
+    }
+    return src;
+}
+
+static iBool isUnchangedSource_Feeds_(iFeeds *d, uint32_t bookmarkId, uint32_t bodyHash) {
+    /* Entries of an unchanged source are still reparsed every now and then so their
+       discovery times are refreshed and they don't get forgotten as being too old. */
+    iBool unchanged = iFalse;
+    lock_Mutex(d->mtx);
+    const iFeedSource *src = (const iFeedSource *) value_Hash(d->sources, bookmarkId);
+    if (src && src->bodyHash == bodyHash && isValid_Time(&src->mergedAt) &&
+        elapsedSeconds_Time(&src->mergedAt) < maxAge_Visited / 2) {
+        unchanged = iTrue;
+    }
+    unlock_Mutex(d->mtx);
+    return unchanged;
+}
+
+static void updateSource_Feeds_(iFeeds *d, const iFeedJob *job, double mergeSeconds) {
+    lock_Mutex(d->mtx);
+    iFeedSource *src = source_Feeds_(d, job->bookmarkId);
+    src->bodyHash    = job->bodyHash;
+    src->parseMicros = (uint32_t) (job->parseSeconds * 1.0e6);
+    src->mergeMicros = (uint32_t) (mergeSeconds * 1.0e6);
+    initCurrent_Time(&src->mergedAt);
+    unlock_Mutex(d->mtx);
+}
+
+static int numOngoingForHost_Feeds_(const iPtrArray *ongoing, const iString *host) {
+    int count = 0;
+    iConstForEach(PtrArray, i, ongoing) {
+        const iFeedJob *job = i.ptr;
+        if (equalCase_String(&job->host, host)) {
+            count++;
+        }
+    }
+    return count;
 }
 
-static iFeedJob *startNextJob_Feeds_(iFeeds *d) {
-    if (isEmpty_PtrArray(&d->jobs)) {
-        return NULL;
+static iFeedJob *startNextJob_Feeds_(iFeeds *d, const iPtrArray *ongoing) {
+    /* Skip jobs whose server already has the maximum number of requests in flight. */
+    iConstForEach(PtrArray, i, &d->jobs) {
+        const iFeedJob *pending = i.ptr;
+        if (numOngoingForHost_Feeds_(ongoing, &pending->host) < d->maxConcurrentPerHost) {
+            iFeedJob *job;
+            take_PtrArray(&d->jobs, index_PtrArrayConstIterator(&i), (void **) &job);
+            submit_FeedJob_(job);
+            return job;
+        }
     }
-    iFeedJob *job;
-    take_PtrArray(&d->jobs, 0, (void **) &job);
-    submit_FeedJob_(job);
-    return job;
+    return NULL;
 }
 
 static iBool isTrimmablePunctuation_(iChar c) {
@@ -200,6 +419,142 @@ static iBool isUrlIgnored_FeedJob_(const iFeedJob *d, iRangecc url) {
     return iFalse;
 }
 
+iDeclareType(FeedLink)
+
+struct Impl_FeedLink {
+    iRangecc url;
+    iRangecc title;
+    iDate    posted;
+};
+
+static iBool isSpace_(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static iBool isDigit_(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int digits_(const char *s, int count) {
+    int value = 0;
+    for (int i = 0; i < count; i++) {
+        value = value * 10 + (s[i] - '0');
+    }
+    return value;
+}
+
+static iBool scan_FeedLink_(iFeedLink *d, iRangecc line) {
+    /* Recognizes "=> URL YYYY-MM-DD title". The title must not begin with a digit. */
+    const char *pos = line.start;
+    const char *end = line.end;
+    if (end - pos < 2 || pos[0] != '=' || pos[1] != '>') {
+        return iFalse;
+    }
+    for (pos += 2; pos < end && isSpace_(*pos); pos++) {}
+    d->url.start = pos;
+    while (pos < end && !isSpace_(*pos)) {
+        pos++;
+    }
+    d->url.end = pos;
+    if (isEmpty_Range(&d->url) || pos == end) {
+        return iFalse;
+    }
+    while (pos < end && isSpace_(*pos)) {
+        pos++;
+    }
+    if (end - pos < 11) {
+        return iFalse;
+    }
+    if (!isDigit_(pos[0]) || !isDigit_(pos[1]) || !isDigit_(pos[2]) || !isDigit_(pos[3]) ||
+        pos[4] != '-' || pos[5] < '0' || pos[5] > '1' || !isDigit_(pos[6]) ||
+        pos[7] != '-' || pos[8] < '0' || pos[8] > '3' || !isDigit_(pos[9]) ||
+        isDigit_(pos[10])) {
+        return iFalse;
+    }
+    iZap(d->posted);
+    d->posted.year  = digits_(pos, 4);
+    d->posted.month = digits_(pos + 5, 2);
+    d->posted.day   = digits_(pos + 8, 2);
+    d->posted.hour  = 12; /* noon UTC */
+    d->title = (iRangecc){ pos + 10, end };
+    return iTrue;
+}
+
+static iBool isPlainPath_(iRangecc url) {
+    /* ASCII-only, and no dot segments or empty segments, so no normalization is needed.
+       A double slash is only allowed at the beginning or right after the scheme. */
+    const char *firstSlash = NULL;
+    for (const char *ch = url.start; ch < url.end; ch++) {
+        if (*ch & 0x80 || (*ch == '.' && (ch == url.start || ch[-1] == '/'))) {
+            return iFalse;
+        }
+        if (*ch == '/') {
+            if (!firstSlash) {
+                firstSlash = ch;
+            }
+            else if (ch[-1] == '/' && !(firstSlash == ch - 1 &&
+                                        (firstSlash == url.start || firstSlash[-1] == ':'))) {
+                return iFalse;
+            }
+        }
+    }
+    return iTrue;
+}
+
+static iBool hasScheme_(iRangecc url) {
+    for (const char *ch = url.start; ch < url.end; ch++) {
+        if (*ch == ':') return iTrue;
+        if (*ch == '/' || *ch == '?' || *ch == '#') break;
+    }
+    return iFalse;
+}
+
+static void setBaseUrl_FeedJob_(iFeedJob *d, const iString *pageUrl) {
+    /* Prefixes for resolving relative links by concatenation. */
+    const iString *base    = absoluteUrl_String(pageUrl, pageUrl);
+    const iRangecc baseDir = urlDirectory_String(base);
+    setRange_String(&d->baseRoot, (iRangecc){ constBegin_String(base), baseDir.start });
+    setRange_String(&d->baseDir, (iRangecc){ constBegin_String(base), baseDir.end });
+    if (!endsWith_String(&d->baseDir, "/")) {
+        appendChar_String(&d->baseDir, '/');
+    }
+}
+
+static const iString *resolveUrl_FeedJob_(iFeedJob *d, iRangecc url) {
+    /* Most links in feeds are either absolute Gemini URLs or simple relative paths. These are
+       put together in a reused buffer. Anything else goes through `absoluteUrl_String`. */
+    iString *resolved = &d->linkUrl;
+    if (isPlainPath_(url)) {
+        if (*url.start == '/' && !startsWith_Rangecc(url, "//")) {
+            set_String(resolved, &d->baseRoot);
+            appendRange_String(resolved, url);
+            return canonicalUrl_String(resolved);
+        }
+        if (*url.start != '/' && *url.start != '?' && *url.start != '#' && !hasScheme_(url)) {
+            set_String(resolved, &d->baseDir);
+            appendRange_String(resolved, url);
+            return canonicalUrl_String(resolved);
+        }
+        if (startsWith_Rangecc(url, "gemini://")) {
+            /* Only needs normalizing if there's a port, user info, IPv6 address, or an IDN. */
+            iRangecc authority = { url.start + 9, url.start + 9 };
+            while (authority.end < url.end && !strchr("/?#", *authority.end)) {
+                authority.end++;
+            }
+            if (authority.end < url.end && *authority.end == '/' &&
+                !iStrStrN(authority.start, ":", size_Range(&authority)) &&
+                !iStrStrN(authority.start, "@", size_Range(&authority)) &&
+                !iStrStrN(authority.start, "[", size_Range(&authority)) &&
+                !iStrStrN(authority.start, "xn--", size_Range(&authority))) {
+                setRange_String(resolved, url);
+                return canonicalUrl_String(resolved);
+            }
+        }
+    }
+    setRange_String(resolved, url);
+    return canonicalUrl_String(absoluteUrl_String(url_GmRequest(d->request), resolved));
+}
+
 static iBool parseResult_FeedJob_(iFeedJob *d) {
     /* Returns true if the job is done and can be released. False means the job continues. */
     if (category_GmStatusCode(status_GmRequest(d->request)) == categoryRedirect_GmStatusCode) {
@@ -214,119 +569,199 @@ static iBool parseResult_FeedJob_(iFeedJob *d) {
     }
     /* TODO: Should tell the user if the request failed. */
     if (isSuccess_GmStatusCode(status_GmRequest(d->request))) {
+        d->bodyHash = bodyHash_FeedJob_(d);
+        if (isUnchangedSource_Feeds_(&feeds_, d->bookmarkId, d->bodyHash)) {
+            d->isUnchanged = iTrue;
+            return iTrue;
+        }
         iBeginCollect();
+        iTime parseStart;
+        initCurrent_Time(&parseStart);
         iTime now;
         iTime perEntryAdjust;
         initSeconds_Time(&perEntryAdjust, 1.0);
         initCurrent_Time(&now);
-        iRegExp *linkPattern =
-            new_RegExp("^=>\\s*([^\\s]+)\\s+"
-                       "([0-9][0-9][0-9][0-9]-[0-1][0-9]-[0-3][0-9])"
-                       "([^0-9].*)",
-                       0);
-        iString src;
-        initBlock_String(&src, &lockResponse_GmRequest(d->request)->body);
-        unlockResponse_GmRequest(d->request);
-        iRangecc srcLine = iNullRange;
-        while (nextSplit_Rangecc(range_String(&src), "\n", &srcLine)) {
+        setBaseUrl_FeedJob_(d, url_GmRequest(d->request));
+        /* The request has finished so the body won't change any more. */
+        const iRangecc src     = range_Block(body_GmRequest(d->request));
+        iRangecc       srcLine = iNullRange;
+        iFeedLink      link;
+        while (nextSplit_Rangecc(src, "\n", &srcLine)) {
             iRangecc line = srcLine;
             trimEnd_Rangecc(&line);
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (matchRange_RegExp(linkPattern, line, &m)) {
-                const iRangecc url   = capturedRange_RegExpMatch(&m, 1);
-                const iRangecc date  = capturedRange_RegExpMatch(&m, 2);
-                const iRangecc title = capturedRange_RegExpMatch(&m, 3);
-                if (isUrlIgnored_FeedJob_(d, url)) {
+            if (scan_FeedLink_(&link, line)) {
+                if (isUrlIgnored_FeedJob_(d, link.url)) {
                     continue;
                 }
                 iFeedEntry *entry = new_FeedEntry();
                 entry->discovered = now;
                 sub_Time(&now, &perEntryAdjust);
                 entry->bookmarkId = d->bookmarkId;
-                setRange_String(&entry->url, url);
-                set_String(&entry->url, canonicalUrl_String(absoluteUrl_String(url_GmRequest(d->request), &entry->url)));
-                setRange_String(&entry->title, title);
+                set_String(&entry->url, resolveUrl_FeedJob_(d, link.url));
+                setRange_String(&entry->title, link.title);
                 trimTitle_(&entry->title);
-                int year, month, day;
-                sscanf(date.start, "%04d-%02d-%02d", &year, &month, &day);
-                init_Time(
-                    &entry->posted,
-                    &(iDate){
-                        .year = year, .month = month, .day = day, .hour = 12 /* noon UTC */ });
+                init_Time(&entry->posted, &link.posted);
                 pushBack_PtrArray(&d->results, entry);
             }
-            if (d->checkHeadings) {
-                init_RegExpMatch(&m);
-                if (startsWith_Rangecc(line, "#")) {
-                    while (*line.start == '#' && line.start < line.end) {
-                        line.start++;
-                    }
-                    trimStart_Rangecc(&line);
-                    iFeedEntry *entry = new_FeedEntry();
-                    entry->isHeading = iTrue;
-                    entry->posted = now;
-                    if (!d->isFirstUpdate) {
-                        entry->discovered = now;
-                        sub_Time(&now, &perEntryAdjust);
-                    }
-                    entry->bookmarkId = d->bookmarkId;
-                    iString *title = newRange_String(line);
-                    set_String(&entry->title, title);
-                    set_String(&entry->url, &d->url);
-                    appendChar_String(&entry->url, '#');
-                    append_String(&entry->url, collect_String(urlEncode_String(title)));
-                    set_String(&entry->url, canonicalUrl_String(&entry->url));
-                    delete_String(title);
-                    pushBack_PtrArray(&d->results, entry);
+            else if (d->checkHeadings && startsWith_Rangecc(line, "#")) {
+                while (*line.start == '#' && line.start < line.end) {
+                    line.start++;
+                }
+                trimStart_Rangecc(&line);
+                iFeedEntry *entry = new_FeedEntry();
+                entry->isHeading = iTrue;
+                entry->posted = now;
+                if (!d->isFirstUpdate) {
+                    entry->discovered = now;
+                    sub_Time(&now, &perEntryAdjust);
                 }
+                entry->bookmarkId = d->bookmarkId;
+                setRange_String(&entry->title, line);
+                set_String(&entry->url, &d->url);
+                appendChar_String(&entry->url, '#');
+                append_String(&entry->url, collect_String(urlEncode_String(&entry->title)));
+                set_String(&entry->url, canonicalUrl_String(&entry->url));
+                pushBack_PtrArray(&d->results, entry);
             }
         }
-        deinit_String(&src);
-        iRelease(linkPattern);
+        d->parseSeconds = elapsedSeconds_Time(&parseStart);
         iEndCollect();
     }
     return iTrue;
 }
 
-static void save_Feeds_(iFeeds *d) {
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_)));
-    if (open_File(f, write_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
-        iString *str = new_String();
-        format_String(str, "%llu\n# Feeds\n", (unsigned long long)
-                      integralSeconds_Time(&d->lastRefreshedAt));
-        write_File(f, utf8_String(str));
-        /* Index of feeds for IDs. */ {
-            iConstForEach(PtrArray, i, listSubscriptions_()) {
-                const iBookmark *bm = i.ptr;
-                format_String(str, "%08x %s\n", id_Bookmark(bm), cstr_String(&bm->url));
-                write_File(f, utf8_String(str));
-            }
+static iBool isExpired_FeedEntry_(const iFeedEntry *d, const iTime *now) {
+    /* Heading entries are kept as long as they are present in the source. */
+    return !d->isHeading && isValid_Time(&d->discovered) &&
+           secondsSince_Time(now, &d->discovered) > maxAge_Visited;
+}
+
+static void serializeEntry_Feeds_(const iFeedEntry *entry, iStream *outs) {
+    writeData_Stream(outs, magicEntry_Feeds_, 4);
+    writeU32_Stream(outs, entry->bookmarkId);
+    writeU64_Stream(outs, integralSeconds_Time(&entry->posted));
+    writeU64_Stream(outs, integralSeconds_Time(&entry->discovered));
+    serialize_String(&entry->url, outs);
+    serialize_String(&entry->title, outs);
+}
+
+static void logEntry_Feeds_(iFeeds *d, const iFeedEntry *entry) {
+    /* Caller must hold the mutex. */
+    serializeEntry_Feeds_(entry, stream_Buffer(d->log));
+    d->numLogged++;
+}
+
+static void logRemoved_Feeds_(iFeeds *d, const iFeedEntry *entry) {
+    /* Caller must hold the mutex. */
+    iStream *outs = stream_Buffer(d->log);
+    writeData_Stream(outs, magicRemoved_Feeds_, 4);
+    writeU32_Stream(outs, entry->bookmarkId);
+    serialize_String(&entry->url, outs);
+    d->numLogged++;
+}
+
+static uint32_t urlHash_FeedEntry_(const iFeedEntry *d) {
+    return iCrc32(cstr_String(&d->url), size_String(&d->url));
+}
+
+static void logSeen_Feeds_(iFeeds *d, uint32_t sourceId, const iTime *when,
+                           const iArray *urlHashes) {
+    /* Caller must hold the mutex. Unchanged entries that were still present in the source
+       are only refreshed, so instead of the entries, a list of their URL hashes is
+       logged. */
+    iStream *outs = stream_Buffer(d->log);
+    writeData_Stream(outs, magicSeen_Feeds_, 4);
+    writeU32_Stream(outs, sourceId);
+    writeU64_Stream(outs, integralSeconds_Time(when));
+    writeU32_Stream(outs, (uint32_t) size_Array(urlHashes));
+    iConstForEach(Array, i, urlHashes) {
+        writeU32_Stream(outs, *(const uint32_t *) i.value);
+    }
+    d->numLogged++;
+}
+
+static size_t serializeIndex_Feeds_(const iFeeds *d, iStream *outs) {
+    /* Bookmark IDs are only valid at runtime, so each batch of records written to the
+       database begins with the current mapping of IDs to feed URLs. */
+    size_t count = 0;
+    writeData_Stream(outs, magicTime_Feeds_, 4);
+    writeU64_Stream(outs, integralSeconds_Time(&d->lastRefreshedAt));
+    iConstForEach(PtrArray, i, listSubscriptions_(d->subscriptions)) {
+        const iBookmark *bm = i.ptr;
+        writeData_Stream(outs, magicFeed_Feeds_, 4);
+        writeU32_Stream(outs, id_Bookmark(bm));
+        serialize_String(&bm->url, outs);
+        count++;
+        /* Status of the feed: hash of the last parsed content, and how long it took to
+           process. */
+        const iFeedSource *src = (const iFeedSource *) value_Hash(d->sources, id_Bookmark(bm));
+        if (src && src->bodyHash) {
+            writeData_Stream(outs, magicSource_Feeds_, 4);
+            writeU32_Stream(outs, src->node.key);
+            writeU32_Stream(outs, src->bodyHash);
+            writeU64_Stream(outs, integralSeconds_Time(&src->mergedAt));
+            writeU32_Stream(outs, src->parseMicros);
+            writeU32_Stream(outs, src->mergeMicros);
+            count++;
         }
-        writeData_File(f, "# Entries\n", 10);
-        iTime now;
+    }
+    return count;
+}
+
+static void compact_Feeds_(iFeeds *d) {
+    /* Caller must hold the mutex. The full database is rewritten, leaving out expired
+       entries and superseded records. */
+    const iString *tempPath = collect_String(concatCStr_Path(&d->saveDir, tempFeedsFilename_Feeds_));
+    iFile *f = new_File(tempPath);
+    if (open_File(f, writeOnly_FileMode)) {
+        iStream *outs = stream_File(f);
+        iTime    now;
         initCurrent_Time(&now);
+        writeData_Stream(outs, magicFeeds_Feeds_, 4);
+        writeU32_Stream(outs, feeds_FileVersion); /* version */
+        serializeIndex_Feeds_(d, outs);
         iConstForEach(Array, i, &d->entries.values) {
             const iFeedEntry *entry = *(const iFeedEntry **) i.value;
-            /* Heading entries are kept as long as they are present in the source. */
-            if (!entry->isHeading && isValid_Time(&entry->discovered) &&
-                secondsSince_Time(&now, &entry->discovered) > maxAge_Visited) {
-                continue; /* Forget entries discovered long ago. */
+            if (!isExpired_FeedEntry_(entry, &now)) {
+                serializeEntry_Feeds_(entry, outs);
             }
-            format_String(str, "%x\n%llu\n%llu\n%s\n%s\n",
-                          entry->bookmarkId,
-                          (unsigned long long) integralSeconds_Time(&entry->posted),
-                          (unsigned long long) integralSeconds_Time(&entry->discovered),
-                          cstr_String(&entry->url),
-                          cstr_String(&entry->title));
-            write_File(f, utf8_String(str));
-        }
-        delete_String(str);
+        }
         close_File(f);
-        unlock_Mutex(d->mtx);
+        iRelease(f);
+        commitFile_App(cstrCollect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_)),
+                       cstr_String(tempPath));
+        d->numAppended    = 0;
+        d->needCompaction = iFalse;
+    }
+    else {
+        iRelease(f);
     }
-    iRelease(f);
+}
+
+static void save_Feeds_(iFeeds *d) {
+    lock_Mutex(d->mtx);
+    if (!d->needCompaction &&
+        d->numAppended + d->numLogged > size_SortedArray(&d->entries) + 1000) {
+        /* Most of the appended records are outdated by now. */
+        d->needCompaction = iTrue;
+    }
+    if (d->needCompaction) {
+        compact_Feeds_(d);
+    }
+    else {
+        iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_)));
+        if (open_File(f, append_FileMode)) {
+            d->numAppended += serializeIndex_Feeds_(d, stream_File(f));
+            writeData_File(f, constData_Block(data_Buffer(d->log)), size_Block(data_Buffer(d->log)));
+            d->numAppended += d->numLogged;
+            close_File(f);
+        }
+        iRelease(f);
+    }
+    close_Buffer(d->log);
+    openEmpty_Buffer(d->log);
+    d->numLogged = 0;
+    unlock_Mutex(d->mtx);
 }
 
 static iBool isHeadingEntry_FeedEntry_(const iFeedEntry *d) {
@@ -367,6 +802,8 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
             if (!contains_StringSet(known, &entry->url)) {
 //                printf("  {%s} is new\n", cstr_String(&entry->url));
                 insert_SortedArray(&d->entries, &entry);
+                index_Feeds_(d, entry);
+                logEntry_Feeds_(d, entry);
                 gotNew = iTrue;
                 remove_PtrArrayIterator(&i);
             }
@@ -382,6 +819,8 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
             if (entry->bookmarkId == sourceId &&
                 !contains_StringSet(presentInSource, &entry->url)) {
 //                printf("    {%s}\n", cstr_String(&entry->url));
+                logRemoved_Feeds_(d, entry);
+                unindex_Feeds_(d, entry);
                 delete_FeedEntry(entry);
                 remove_ArrayIterator(&e);
             }
@@ -403,6 +842,8 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
             }
         }
         iStringSet *handledUrls = new_StringSet();
+        iArray      seen; /* URL hashes of refreshed entries */
+        init_Array(&seen, sizeof(uint32_t));
         lock_Mutex(d->mtx);
         iForEach(PtrArray, i, incoming) {
             iFeedEntry *entry = i.ptr;
@@ -429,9 +870,20 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
                      newDate.day != oldDate.day)) {
                     changed = iTrue;
                 }
+                /* Only modified entries need to be logged again. */
+                const iBool isModified = !equal_String(&existing->title, &entry->title) ||
+                                         cmp_Time(&existing->posted, &entry->posted) != 0;
+                unindex_Feeds_(d, existing);
                 set_String(&existing->title, &entry->title);
                 existing->posted     = entry->posted;
                 existing->discovered = entry->discovered; /* prevent discarding */
+                index_Feeds_(d, existing);
+                if (isModified) {
+                    logEntry_Feeds_(d, existing);
+                }
+                else {
+                    pushBack_Array(&seen, &(uint32_t){ urlHash_FeedEntry_(existing) });
+                }
                 delete_FeedEntry(entry);
                 if (changed) {
                     /* TODO: better to use a new flag for read feed entries? */
@@ -441,11 +893,17 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
             }
             else {
                 insert_SortedArray(&d->entries, &entry);
+                index_Feeds_(d, entry);
+                logEntry_Feeds_(d, entry);
                 gotNew = iTrue;
             }
             remove_PtrArrayIterator(&i);
         }
+        if (!isEmpty_Array(&seen)) {
+            logSeen_Feeds_(d, sourceId, &now, &seen);
+        }
         unlock_Mutex(d->mtx);
+        deinit_Array(&seen);
         fflush(stdout);
         iRelease(handledUrls);
     }
@@ -455,66 +913,71 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
 static iThreadResult fetch_Feeds_(iThread *thread) {
     iFeeds *d = &feeds_;
     iUnused(thread);
-    iFeedJob *work[maxConcurrentRequests_Feeds]; /* We'll do a couple of concurrent requests. */
-    iZap(work);
+    iPtrArray work; /* ongoing jobs */
+    init_PtrArray(&work);
     iBool gotNew = iFalse;
     postCommand_App("feeds.update.started");
     const size_t totalJobs = size_PtrArray(&d->jobs);
     int numFinishedJobs = 0;
     while (!d->stopWorker) {
         /* Start new jobs. */
-        iForIndices(i, work) {
-            if (!work[i]) {
-                work[i] = startNextJob_Feeds_(d);
-            }
+        while (size_PtrArray(&work) < (size_t) d->maxConcurrent) {
+            iFeedJob *job = startNextJob_Feeds_(d, &work);
+            if (!job) break;
+            pushBack_PtrArray(&work, job);
+        }
+        /* Sleep until a request finishes. Timeouts are checked at least once per second. */
+        lock_Mutex(d->mtx);
+        if (!d->stopWorker && !d->isWakeupPending) {
+            iTime until;
+            initTimeout_Time(&until, 1.0);
+            waitTimeout_Condition(&d->wakeup, d->mtx, &until);
         }
-        sleep_Thread(0.5); /* TODO: wait on a Condition so we can exit quickly */
+        d->isWakeupPending = iFalse;
+        unlock_Mutex(d->mtx);
         if (d->stopWorker) break;
-        size_t ongoing = 0;
         iBool doNotify = iFalse;
-        iForIndices(i, work) {
-            if (work[i]) {
-                if (isFinished_GmRequest(work[i]->request)) {
-                    if (parseResult_FeedJob_(work[i])) {
+        iForEach(PtrArray, i, &work) {
+            iFeedJob *job = i.ptr;
+            if (isFinished_GmRequest(job->request)) {
+                if (parseResult_FeedJob_(job)) {
+                    if (!job->isUnchanged) {
+                        iTime mergeStart;
+                        initCurrent_Time(&mergeStart);
                         gotNew |= updateEntries_Feeds_(
-                            d, work[i]->checkHeadings, work[i]->bookmarkId, &work[i]->results);
-                        delete_FeedJob(work[i]);
-                        work[i] = NULL;
-                        numFinishedJobs++;
-                        doNotify = iTrue;
-                    }
-                    else {
-                        ongoing++;
+                            d, job->checkHeadings, job->bookmarkId, &job->results);
+                        if (job->bodyHash) {
+                            updateSource_Feeds_(d, job, elapsedSeconds_Time(&mergeStart));
+                        }
                     }
-                }
-                else if (isTimedOut_FeedJob_(work[i])) {
-                    /* Maybe we'll get it next time! */
-                    delete_FeedJob(work[i]);
-                    work[i] = NULL;
+                    delete_FeedJob(job);
+                    remove_PtrArrayIterator(&i);
                     numFinishedJobs++;
                     doNotify = iTrue;
                 }
-                else {
-                    ongoing++;
-                }
-                /* TODO: abort job if it takes too long (> 15 seconds?) */
+            }
+            else if (isTimedOut_FeedJob_(job)) {
+                /* Maybe we'll get it next time! */
+                delete_FeedJob(job);
+                remove_PtrArrayIterator(&i);
+                numFinishedJobs++;
+                doNotify = iTrue;
             }
         }
         if (doNotify) {
             postCommandf_App("feeds.update.progress arg:%d total:%zu", numFinishedJobs, totalJobs);
         }
         /* Stop if everything has finished. */
-        if (ongoing == 0 && isEmpty_PtrArray(&d->jobs)) {
+        if (isEmpty_PtrArray(&work) && isEmpty_PtrArray(&d->jobs)) {
             break;
         }
     }
-    if (d->stopWorker) {
-        iForIndices(i, work) {
-            if (work[i]) {
-                cancel_GmRequest(work[i]->request);
-            }
-        }
+    iForEach(PtrArray, i, &work) {
+        iFeedJob *job = i.ptr;
+        cancel_GmRequest(job->request);
+        delete_FeedJob(job);
     }
+    deinit_PtrArray(&work);
     initCurrent_Time(&d->lastRefreshedAt);
     save_Feeds_(d);
     /* Check if there are visited URLs marked as Kept that can be cleared because they are no
@@ -527,9 +990,9 @@ static iThreadResult fetch_Feeds_(iThread *thread) {
         }
         unlock_Mutex(d->mtx);
         iConstForEach(PtrArray, j, listKept_Visited(visited_App())) {
-            iVisitedUrl *visUrl = j.ptr;
+            const iVisitedUrl *visUrl = j.ptr;
             if (!contains_StringSet(knownEntryUrls, &visUrl->url)) {
-                visUrl->flags &= ~kept_VisitedUrlFlag;
+                setUrlKept_Visited(visited_App(), &visUrl->url, iFalse);
 //                printf("unkept: {%s}\n", cstr_String(&visUrl->url));
             }
         }
@@ -544,8 +1007,13 @@ static iBool startWorker_Feeds_(iFeeds *d) {
     if (d->worker) {
         return iFalse; /* Refresh is already ongoing. */
     }
+    if (!d->isLoaded) {
+        return iFalse; /* Database is still being loaded. */
+    }
     /* Queue up all the subscriptions for the worker. */
-    iConstForEach(PtrArray, i, listSubscriptions_()) {
+    iAssert(!d->subscriptions);
+    d->subscriptions = ref_Object(snapshot_Bookmarks(bookmarks_App()));
+    iConstForEach(PtrArray, i, listSubscriptions_(d->subscriptions)) {
         const iBookmark *bm = i.ptr;
         iFeedJob *job = new_FeedJob(bm);
         if (!contains_IntSet(&d->previouslyCheckedFeeds, id_Bookmark(bm))) {
@@ -557,17 +1025,23 @@ static iBool startWorker_Feeds_(iFeeds *d) {
         pushBack_PtrArray(&d->jobs, job);
     }
     if (!isEmpty_Array(&d->jobs)) {
+        const iPrefs *prefs = prefs_App();
+        d->maxConcurrent        = iMax(1, prefs->feedConcurrency);
+        d->maxConcurrentPerHost = iMax(1, prefs->feedHostConcurrency);
         d->worker = new_Thread(fetch_Feeds_);
         d->stopWorker = iFalse;
+        d->isWakeupPending = iFalse;
         start_Thread(d->worker);
         return iTrue;
     }
+    iReleasePtr(&d->subscriptions);
     return iFalse;
 }
 
 static uint32_t refresh_Feeds_(uint32_t interval, void *data) {
-    /* Called in the SDL timer thread, so let's start a worker thread for running the refresh. */
-    startWorker_Feeds_(&feeds_);
+    /* Called in the SDL timer thread. The worker is started in the main thread, where the
+       bookmarks can be snapshotted. */
+    postCommand_App("feeds.refresh");
     return feeds_.refreshInterval;
 }
 
@@ -580,9 +1054,13 @@ static void removeRefreshTimer_Feeds_(iFeeds *d) {
 
 static void stopWorker_Feeds_(iFeeds *d) {
     if (d->worker) {
-        d->stopWorker = iTrue;
+        iGuardMutex(d->mtx, {
+            d->stopWorker = iTrue;
+            signal_Condition(&d->wakeup);
+        });
         join_Thread(d->worker);
         iReleasePtr(&d->worker);
+        iReleasePtr(&d->subscriptions);
     }
     /* Clear remaining jobs. */
     iForEach(PtrArray, i, &d->jobs) {
@@ -591,16 +1069,6 @@ static void stopWorker_Feeds_(iFeeds *d) {
     clear_PtrArray(&d->jobs);
 }
 
-static int cmp_FeedEntryPtr_(const void *a, const void *b) {
-    const iFeedEntry * const *elem[2] = { a, b };
-    const int cmp = cmpString_String(&(*elem[0])->url, &(*elem[1])->url);
-    if (cmp == 0) {
-        /* The same URL can be coming from different feeds. */
-        return iCmp((*elem[0])->bookmarkId, (*elem[1])->bookmarkId);
-    }
-    return cmp;
-}
-
 iDeclareType(FeedHashNode)
 
 struct Impl_FeedHashNode {
@@ -608,110 +1076,363 @@ struct Impl_FeedHashNode {
     uint32_t  bookmarkId;
 };
 
-static void load_Feeds_(iFeeds *d) {
-    /* TODO: If there are lots of entries, it would make sense to load async. */
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_)));
-    if (open_File(f, read_FileMode | text_FileMode)) {
-        iBlock * src     = readAll_File(f);
-        iRangecc line    = iNullRange;
-        int      section = 0;
-        iHash *  feeds   = new_Hash(); /* mapping from IDs to feed URLs */
-        while (nextSplit_Rangecc(range_Block(src), "\n", &line)) {
-            if (equal_Rangecc(line, "# Feeds")) {
-                section = 1;
-                continue;
+static void mapFeedId_Feeds_(iFeeds *d, iHash *feeds, uint32_t id, const iString *feedUrl) {
+    free(remove_Hash(feeds, id));
+    const uint32_t bookmarkId = findUrl_Bookmarks(bookmarks_App(), feedUrl);
+    if (bookmarkId) {
+        iFeedHashNode *node = iMalloc(FeedHashNode);
+        node->node.key      = id;
+        node->bookmarkId    = bookmarkId;
+        insert_Hash(feeds, &node->node);
+        iGuardMutex(d->mtx, insert_IntSet(&d->previouslyCheckedFeeds, bookmarkId));
+    }
+}
+
+static void insertLoadedEntry_Feeds_(iSortedArray *entries, iFeedEntry *entry) {
+    size_t pos;
+    if (locate_SortedArray(entries, &entry, &pos)) {
+        /* The latest record replaces earlier ones. */
+        iFeedEntry **existing = at_SortedArray(entries, pos);
+        delete_FeedEntry(*existing);
+        *existing = entry;
+    }
+    else {
+        insert_SortedArray(entries, &entry);
+    }
+}
+
+static void removeLoadedEntry_Feeds_(iSortedArray *entries, uint32_t bookmarkId,
+                                     const iString *url) {
+    const iFeedEntry  key    = { .url = *url, .bookmarkId = bookmarkId };
+    const iFeedEntry *keyPtr = &key;
+    size_t pos;
+    if (locate_SortedArray(entries, &keyPtr, &pos)) {
+        delete_FeedEntry(*(iFeedEntry **) at_SortedArray(entries, pos));
+        remove_Array(&entries->values, pos);
+    }
+}
+
+static void loadText_Feeds_(iFeeds *d, iFile *f, iSortedArray *entries, iTime *lastRefreshedAt) {
+    /* Feeds used to be saved in a text file. */
+    iBlock * src     = readAll_File(f);
+    iRangecc line    = iNullRange;
+    int      section = 0;
+    iHash *  feeds   = new_Hash(); /* mapping from IDs to feed URLs */
+    while (nextSplit_Rangecc(range_Block(src), "\n", &line)) {
+        if (equal_Rangecc(line, "# Feeds")) {
+            section = 1;
+            continue;
+        }
+        else if (equal_Rangecc(line, "# Sources")) {
+            section = 3;
+            continue;
+        }
+        else if (equal_Rangecc(line, "# Entries")) {
+            section = 2;
+            continue;
+        }
+        switch (section) {
+            case 0: {
+                unsigned long long ts = 0;
+                sscanf(line.start, "%llu", &ts);
+                lastRefreshedAt->ts.tv_sec = ts;
+                break;
             }
-            else if (equal_Rangecc(line, "# Entries")) {
-                section = 2;
-                continue;
+            case 1: {
+                if (size_Range(&line) > 8) {
+                    uint32_t id = 0;
+                    sscanf(line.start, "%08x", &id);
+                    iString *feedUrl =
+                        collect_String(newRange_String((iRangecc){ line.start + 9, line.end }));
+                    mapFeedId_Feeds_(d, feeds, id, feedUrl);
+                }
+                break;
             }
-            switch (section) {
-                case 0: {
-                    unsigned long long ts = 0;
-                    sscanf(line.start, "%llu", &ts);
-                    d->lastRefreshedAt.ts.tv_sec = ts;
-                    break;
+            case 2: {
+                /* TODO: Cleanup needed...
+                   All right, this could maybe use a bit more robust, structured format.
+                   The code below is messy. */
+                const uint32_t feedId = (uint32_t) strtoul(line.start, NULL, 16);
+                if (!nextSplit_Rangecc(range_Block(src), "\n", &line)) {
+                    goto aborted;
                 }
-                case 1: {
-                    if (size_Range(&line) > 8) {
-                        uint32_t id = 0;
-                        sscanf(line.start, "%08x", &id);
-                        iString *feedUrl =
-                            collect_String(newRange_String((iRangecc){ line.start + 9, line.end }));
-                        const uint32_t bookmarkId = findUrl_Bookmarks(bookmarks_App(), feedUrl);
-                        if (bookmarkId) {
-                            iFeedHashNode *node = iMalloc(FeedHashNode);
-                            node->node.key      = id;
-                            node->bookmarkId    = bookmarkId;
-                            insert_Hash(feeds, &node->node);
-                            insert_IntSet(&d->previouslyCheckedFeeds, bookmarkId);
-                        }
-                    }
-                    break;
+                const unsigned long long posted = strtoull(line.start, NULL, 10);
+                if (posted == 0) {
+                    goto aborted;
                 }
-                case 2: {
-                    /* TODO: Cleanup needed...
-                       All right, this could maybe use a bit more robust, structured format.
-                       The code below is messy. */
-                    const uint32_t feedId = (uint32_t) strtoul(line.start, NULL, 16);
-                    if (!nextSplit_Rangecc(range_Block(src), "\n", &line)) {
-                        goto aborted;
-                    }
-                    const unsigned long long posted = strtoull(line.start, NULL, 10);
-                    if (posted == 0) {
-                        goto aborted;
-                    }
-                    if (!nextSplit_Rangecc(range_Block(src), "\n", &line)) {
-                        goto aborted;
-                    }
-                    char *endp = NULL;
-                    const unsigned long long discovered = strtoull(line.start, &endp, 10);
-                    if (endp != line.end) {
-                        goto aborted;
-                    }
-                    if (!nextSplit_Rangecc(range_Block(src), "\n", &line)) {
-                        goto aborted;
-                    }
-                    const iRangecc urlRange = line;
-                    if (!nextSplit_Rangecc(range_Block(src), "\n", &line)) {
-                        goto aborted;
-                    }
-                    const iRangecc titleRange = line;
-                    iString *url   = newRange_String(urlRange);
-                    iString *title = newRange_String(titleRange);
-                    /* Look it up in the hash. */
-                    const iFeedHashNode *node = (iFeedHashNode *) value_Hash(feeds, feedId);
-                    if (node) {
-                        iFeedEntry *entry = new_FeedEntry();
-                        entry->bookmarkId           = node->bookmarkId;
-                        entry->posted.ts.tv_sec     = posted;
-                        entry->discovered.ts.tv_sec = discovered;
-                        set_String(&entry->url, url);
-                        stripDefaultUrlPort_String(&entry->url);
-                        set_String(&entry->url, canonicalUrl_String(&entry->url));
-                        set_String(&entry->title, title);
-                        entry->isHeading = isHeadingEntry_FeedEntry_(entry);
+                if (!nextSplit_Rangecc(range_Block(src), "\n", &line)) {
+                    goto aborted;
+                }
+                char *endp = NULL;
+                const unsigned long long discovered = strtoull(line.start, &endp, 10);
+                if (endp != line.end) {
+                    goto aborted;
+                }
+                if (!nextSplit_Rangecc(range_Block(src), "\n", &line)) {
+                    goto aborted;
+                }
+                const iRangecc urlRange = line;
+                if (!nextSplit_Rangecc(range_Block(src), "\n", &line)) {
+                    goto aborted;
+                }
+                const iRangecc titleRange = line;
+                iString *url   = newRange_String(urlRange);
+                iString *title = newRange_String(titleRange);
+                /* Look it up in the hash. */
+                const iFeedHashNode *node = (iFeedHashNode *) value_Hash(feeds, feedId);
+                if (node) {
+                    iFeedEntry *entry = new_FeedEntry();
+                    entry->bookmarkId           = node->bookmarkId;
+                    entry->posted.ts.tv_sec     = posted;
+                    entry->discovered.ts.tv_sec = discovered;
+                    set_String(&entry->url, url);
+                    stripDefaultUrlPort_String(&entry->url);
+                    set_String(&entry->url, canonicalUrl_String(&entry->url));
+                    set_String(&entry->title, title);
+                    entry->isHeading = isHeadingEntry_FeedEntry_(entry);
 //                        if (entry->isHeading) {
 //                            printf("[Feeds] src:%d url:{%s}\n", entry->bookmarkId,
 //                                   cstr_String(&entry->url));
 //                        }
-                        insert_SortedArray(&d->entries, &entry);
+                    insert_SortedArray(entries, &entry);
+                }
+                delete_String(title);
+                delete_String(url);
+                break;
+            }
+            case 3: {
+                uint32_t id = 0, bodyHash = 0, parseMicros = 0, mergeMicros = 0;
+                unsigned long long mergedAt = 0;
+                if (sscanf(line.start, "%08x %08x %llu %u %u",
+                           &id, &bodyHash, &mergedAt, &parseMicros, &mergeMicros) == 5) {
+                    const iFeedHashNode *node = (iFeedHashNode *) value_Hash(feeds, id);
+                    if (node) {
+                        lock_Mutex(d->mtx);
+                        iFeedSource *src = source_Feeds_(d, node->bookmarkId);
+                        src->bodyHash        = bodyHash;
+                        src->mergedAt.ts     = (struct timespec){ .tv_sec = mergedAt };
+                        src->parseMicros     = parseMicros;
+                        src->mergeMicros     = mergeMicros;
+                        unlock_Mutex(d->mtx);
                     }
-                    delete_String(title);
-                    delete_String(url);
-                    break;
                 }
+                break;
             }
         }
-    aborted:
-        /* Cleanup. */
-        delete_Block(src);
-        iForEach(Hash, i, feeds) {
-            free(i.value);
+    }
+aborted:
+    /* Cleanup. */
+    delete_Block(src);
+    iForEach(Hash, i, feeds) {
+        free(i.value);
+    }
+    delete_Hash(feeds);
+}
+
+iDeclareType(FeedSeen)
+
+struct Impl_FeedSeen {
+    uint32_t bookmarkId;
+    uint32_t urlHash;
+    uint64_t when;
+};
+
+static int cmp_FeedSeen_(const void *a, const void *b) {
+    const iFeedSeen *s1 = a, *s2 = b;
+    if (s1->bookmarkId != s2->bookmarkId) {
+        return iCmp(s1->bookmarkId, s2->bookmarkId);
+    }
+    return iCmp(s1->urlHash, s2->urlHash);
+}
+
+static void applySeen_Feeds_(iSortedArray *entries, iArray *seen) {
+    /* Entries that were seen in their source after they were saved have a later
+       discovery time. */
+    sort_Array(seen, cmp_FeedSeen_);
+    iConstForEach(Array, i, &entries->values) {
+        iFeedEntry *entry = *(iFeedEntry **) i.value;
+        if (!isValid_Time(&entry->discovered)) {
+            continue;
+        }
+        const iFeedSeen key = { entry->bookmarkId, urlHash_FeedEntry_(entry), 0 };
+        const iFeedSeen *found =
+            bsearch(&key, constData_Array(seen), size_Array(seen), sizeof(iFeedSeen), cmp_FeedSeen_);
+        if (!found) {
+            continue;
+        }
+        /* The same entry may have been seen several times. */
+        while (found > (const iFeedSeen *) constData_Array(seen) && !cmp_FeedSeen_(found - 1, &key)) {
+            found--;
+        }
+        const iFeedSeen *end = (const iFeedSeen *) constData_Array(seen) + size_Array(seen);
+        for (; found != end && !cmp_FeedSeen_(found, &key); found++) {
+            if (integralSeconds_Time(&entry->discovered) < found->when) {
+                entry->discovered.ts = (struct timespec){ .tv_sec = found->when };
+            }
+        }
+    }
+}
+
+static void removeExpired_Feeds_(iSortedArray *entries, const iTime *now) {
+    iForEach(Array, i, &entries->values) {
+        iFeedEntry *entry = *(iFeedEntry **) i.value;
+        if (isExpired_FeedEntry_(entry, now)) {
+            delete_FeedEntry(entry);
+            remove_ArrayIterator(&i);
+        }
+    }
+}
+
+static iBool loadBinary_Feeds_(iFeeds *d, iFile *f, iSortedArray *entries, iTime *lastRefreshedAt) {
+    /* Returns false if the file is not fully valid, in which case it should be rewritten. */
+    iBool    ok  = iTrue;
+    iBuffer *buf = iClob(new_Buffer());
+    open_Buffer(buf, collect_Block(readAll_File(f)));
+    iStream *ins = stream_Buffer(buf);
+    char magic[4];
+    readData_Stream(ins, sizeof(magic), magic);
+    if (memcmp(magic, magicFeeds_Feeds_, sizeof(magic))) {
+        fprintf(stderr, "[Feeds] database format not recognized\n");
+        return iFalse;
+    }
+    const uint32_t version = readU32_Stream(ins);
+    if (version > feeds_FileVersion) {
+        fprintf(stderr, "[Feeds] unsupported version (%u)\n", version);
+        return iFalse;
+    }
+    setVersion_Stream(ins, version);
+    iHash   *feeds = new_Hash(); /* mapping from IDs to feed URLs */
+    iString *url   = new_String();
+    iArray   seen;
+    iTime    now;
+    init_Array(&seen, sizeof(iFeedSeen));
+    initCurrent_Time(&now);
+    size_t numRecords = 0;
+    while (!atEnd_Stream(ins)) {
+        readData_Stream(ins, sizeof(magic), magic);
+        numRecords++;
+        if (!memcmp(magic, magicTime_Feeds_, sizeof(magic))) {
+            lastRefreshedAt->ts = (struct timespec){ .tv_sec = readU64_Stream(ins) };
+        }
+        else if (!memcmp(magic, magicFeed_Feeds_, sizeof(magic))) {
+            const uint32_t id = readU32_Stream(ins);
+            deserialize_String(url, ins);
+            mapFeedId_Feeds_(d, feeds, id, url);
+        }
+        else if (!memcmp(magic, magicSource_Feeds_, sizeof(magic))) {
+            const uint32_t id           = readU32_Stream(ins);
+            const uint32_t bodyHash     = readU32_Stream(ins);
+            const uint64_t mergedAt     = readU64_Stream(ins);
+            const uint32_t parseMicros  = readU32_Stream(ins);
+            const uint32_t mergeMicros  = readU32_Stream(ins);
+            const iFeedHashNode *node = (iFeedHashNode *) value_Hash(feeds, id);
+            if (node) {
+                lock_Mutex(d->mtx);
+                iFeedSource *src = source_Feeds_(d, node->bookmarkId);
+                src->bodyHash    = bodyHash;
+                src->mergedAt.ts = (struct timespec){ .tv_sec = mergedAt };
+                src->parseMicros = parseMicros;
+                src->mergeMicros = mergeMicros;
+                unlock_Mutex(d->mtx);
+            }
+        }
+        else if (!memcmp(magic, magicEntry_Feeds_, sizeof(magic))) {
+            iFeedEntry *entry = new_FeedEntry();
+            const uint32_t id = readU32_Stream(ins);
+            entry->posted.ts     = (struct timespec){ .tv_sec = readU64_Stream(ins) };
+            entry->discovered.ts = (struct timespec){ .tv_sec = readU64_Stream(ins) };
+            deserialize_String(&entry->url, ins);
+            deserialize_String(&entry->title, ins);
+            entry->isHeading = isHeadingEntry_FeedEntry_(entry);
+            const iFeedHashNode *node = (iFeedHashNode *) value_Hash(feeds, id);
+            if (node) {
+                /* Expiration is checked after all records have been read. */
+                entry->bookmarkId = node->bookmarkId;
+                insertLoadedEntry_Feeds_(entries, entry);
+            }
+            else {
+                delete_FeedEntry(entry);
+            }
+        }
+        else if (!memcmp(magic, magicRemoved_Feeds_, sizeof(magic))) {
+            const uint32_t id = readU32_Stream(ins);
+            deserialize_String(url, ins);
+            const iFeedHashNode *node = (iFeedHashNode *) value_Hash(feeds, id);
+            if (node) {
+                removeLoadedEntry_Feeds_(entries, node->bookmarkId, url);
+            }
+        }
+        else if (!memcmp(magic, magicSeen_Feeds_, sizeof(magic))) {
+            const uint32_t       id    = readU32_Stream(ins);
+            const uint64_t       when  = readU64_Stream(ins);
+            const uint32_t       count = readU32_Stream(ins);
+            const iFeedHashNode *node  = (iFeedHashNode *) value_Hash(feeds, id);
+            for (uint32_t j = 0; j < count && !atEnd_Stream(ins); j++) {
+                const uint32_t urlHash = readU32_Stream(ins);
+                if (node) {
+                    pushBack_Array(&seen, &(iFeedSeen){ node->bookmarkId, urlHash, when });
+                }
+            }
+        }
+        else {
+            /* Possibly an incomplete append. Everything before this is still usable. */
+            fprintf(stderr, "[Feeds] invalid database record\n");
+            ok = iFalse;
+            break;
+        }
+    }
+    applySeen_Feeds_(entries, &seen);
+    removeExpired_Feeds_(entries, &now);
+    deinit_Array(&seen);
+    d->numAppended = numRecords;
+    delete_String(url);
+    iForEach(Hash, i, feeds) {
+        free(i.value);
+    }
+    delete_Hash(feeds);
+    return ok;
+}
+
+static iThreadResult load_Feeds_(iThread *thread) {
+    iFeeds *d = &feeds_;
+    iUnused(thread);
+    iSortedArray entries;
+    iTime        lastRefreshedAt;
+    iBool        needCompaction = iFalse;
+    init_SortedArray(&entries, sizeof(iFeedEntry *), cmp_FeedEntryPtr_);
+    iZap(lastRefreshedAt);
+    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_)));
+    if (open_File(f, readOnly_FileMode)) {
+        needCompaction = !loadBinary_Feeds_(d, f, &entries, &lastRefreshedAt);
+    }
+    else {
+        iRelease(f);
+        f = new_File(collect_String(concatCStr_Path(&d->saveDir, oldFeedsFilename_Feeds_)));
+        if (open_File(f, readOnly_FileMode | text_FileMode)) {
+            loadText_Feeds_(d, f, &entries, &lastRefreshedAt);
+            needCompaction = iTrue; /* convert to the new format */
         }
-        delete_Hash(feeds);
     }
     iRelease(f);
+    /* Time index of the loaded entries. */
+    iSortedArray byTime;
+    init_SortedArray(&byTime, sizeof(iFeedEntry *), cmpTimeDescending_FeedEntryPtr_);
+    setCopy_Array(&byTime.values, &entries.values);
+    sort_Array(&byTime.values, cmpTimeDescending_FeedEntryPtr_);
+    lock_Mutex(d->mtx);
+    iAssert(isEmpty_SortedArray(&d->entries));
+    iSwap(iSortedArray, d->entries, entries);
+    iSwap(iSortedArray, d->byTime, byTime);
+    d->lastRefreshedAt  = lastRefreshedAt;
+    d->needCompaction   = needCompaction;
+    d->isLoaded         = iTrue;
+    d->isNumUnreadValid = iFalse;
+    d->isTextIndexValid = iFalse;
+    unlock_Mutex(d->mtx);
+    deinit_SortedArray(&byTime);
+    deinit_SortedArray(&entries);
+    postCommandf_App("feeds.update.loaded unread:%zu", numUnread_Feeds());
+    return 0;
 }
 
 /*----------------------------------------------------------------------------------------------*/
@@ -724,19 +1445,46 @@ void init_Feeds(const char *saveDir) {
     init_IntSet(&d->previouslyCheckedFeeds);
     iZap(d->lastRefreshedAt);
     d->worker = NULL;
+    d->subscriptions = NULL;
+    init_Condition(&d->wakeup);
+    d->isWakeupPending = iFalse;
+    d->maxConcurrent = 4;
+    d->maxConcurrentPerHost = 2;
     init_PtrArray(&d->jobs);
     init_SortedArray(&d->entries, sizeof(iFeedEntry *), cmp_FeedEntryPtr_);
-    load_Feeds_(d);
-    setRefreshInterval_Feeds(prefs_App()->feedInterval);
+    init_SortedArray(&d->byTime, sizeof(iFeedEntry *), cmpTimeDescending_FeedEntryPtr_);
+    init_TrigramIndex(&d->textIndex);
+    init_PtrArray(&d->textSlots);
+    init_Array(&d->freeTextSlots, sizeof(uint32_t));
+    d->isTextIndexValid = iFalse;
+    d->numUnread = 0;
+    d->numUnreadVisitedGen = 0;
+    d->isNumUnreadValid = iFalse;
+    d->sources = new_Hash();
+    d->log = new_Buffer();
+    openEmpty_Buffer(d->log);
+    d->numLogged = 0;
+    d->numAppended = 0;
+    d->needCompaction = iFalse;
+    d->isLoaded = iFalse;
+    /* The refresh timer is started when loading has finished. */
+    d->loader = new_Thread(load_Feeds_);
+    start_Thread(d->loader);
 }
 
 void deinit_Feeds(void) {
     iFeeds *d = &feeds_;
+    if (d->loader) {
+        join_Thread(d->loader);
+        iReleasePtr(&d->loader);
+    }
     removeRefreshTimer_Feeds_(d);
     stopWorker_Feeds_(d);
     iAssert(isEmpty_PtrArray(&d->jobs));
     deinit_PtrArray(&d->jobs);
     deinit_String(&d->saveDir);
+    deinit_Condition(&d->wakeup);
+    iRelease(d->log);
     delete_Mutex(d->mtx);
     iForEach(Array, i, &d->entries.values) {
         iFeedEntry **entry = i.value;
@@ -744,6 +1492,14 @@ void deinit_Feeds(void) {
     }
     deinit_IntSet(&d->previouslyCheckedFeeds);
     deinit_SortedArray(&d->entries);
+    deinit_SortedArray(&d->byTime);
+    deinit_TrigramIndex(&d->textIndex);
+    deinit_PtrArray(&d->textSlots);
+    deinit_Array(&d->freeTextSlots);
+    iForEach(Hash, s, d->sources) {
+        free(s.value);
+    }
+    delete_Hash(d->sources);
 }
 
 void refresh_Feeds(void) {
@@ -767,15 +1523,29 @@ void refreshFinished_Feeds(void) {
     stopWorker_Feeds_(&feeds_);
 }
 
+void loadFinished_Feeds(void) {
+    iFeeds *d = &feeds_;
+    if (d->loader) {
+        join_Thread(d->loader);
+        iReleasePtr(&d->loader);
+        setRefreshInterval_Feeds(prefs_App()->feedInterval);
+    }
+}
+
 void removeEntries_Feeds(uint32_t feedBookmarkId) {
     iFeeds *d = &feeds_;
+    lock_Mutex(d->mtx);
+    free(remove_Hash(d->sources, feedBookmarkId));
     iForEach(Array, i, &d->entries.values) {
         iFeedEntry **entry = i.value;
         if ((*entry)->bookmarkId == feedBookmarkId) {
+            logRemoved_Feeds_(d, *entry);
+            unindex_Feeds_(d, *entry);
             delete_FeedEntry(*entry);
             remove_ArrayIterator(&i);
         }
     }
+    unlock_Mutex(d->mtx);
 }
 
 void markEntryAsRead_Feeds(uint32_t feedBookmarkId, const iString *entryUrl, iBool isRead) {
@@ -836,39 +1606,63 @@ iBool isUnreadEntry_Feeds(uint32_t feedBookmarkId, const iString *entryUrl) {
     return isUnread;
 }
 
-static int cmpTimeDescending_FeedEntryPtr_(const void *a, const void *b) {
-    const iFeedEntry * const *e1 = a, * const *e2 = b;
-    const int cmpPosted = -cmp_Time(&(*e1)->posted, &(*e2)->posted);
-    if (cmpPosted) return cmpPosted;
-    /* Posting timestamps may only be accurate to a day, so also sort by discovery time. */
-    return -cmp_Time(&(*e1)->discovered, &(*e2)->discovered);
-}
-
 const iPtrArray *listEntries_Feeds(void) {
     iFeeds *d = &feeds_;
     lock_Mutex(d->mtx);
     /* The worker will never delete feed entries so we can use the same ones. Just make a copy
-       of the array in case the worker modifies it. */
-    iPtrArray *list = collect_PtrArray(copy_Array(&d->entries.values));
+       of the array in case the worker modifies it. The time index is already in the right
+       order. */
+    iPtrArray *list = collect_PtrArray(copy_Array(&d->byTime.values));
+    unlock_Mutex(d->mtx);
+    return list;
+}
+
+const iPtrArray *listMatchingEntries_Feeds(const iString *term) {
+    iFeeds *d = &feeds_;
+    iIntSet slots;
+    init_IntSet(&slots);
+    lock_Mutex(d->mtx);
+    validateTextIndex_Feeds_(d);
+    if (!query_TrigramIndex(&d->textIndex, term, &slots)) {
+        /* The term is too short to narrow down the search. */
+        unlock_Mutex(d->mtx);
+        deinit_IntSet(&slots);
+        return listEntries_Feeds();
+    }
+    iPtrArray *list = collectNew_PtrArray();
+    iConstForEach(IntSet, i, &slots) {
+        pushBack_PtrArray(list, at_PtrArray(&d->textSlots, *i.value));
+    }
     unlock_Mutex(d->mtx);
-    sort_Array(list, cmpTimeDescending_FeedEntryPtr_);
+    deinit_IntSet(&slots);
     return list;
 }
 
 size_t numSubscribed_Feeds(void) {
-    return size_PtrArray(listSubscriptions_());
+    return size_PtrArray(listSubscriptions_(snapshot_Bookmarks(bookmarks_App())));
 }
 
 size_t numUnread_Feeds(void) {
-    size_t count = 0;
-    size_t max = 100; /* match the number of items shown in the sidebar */
-    iConstForEach(PtrArray, i, listEntries_Feeds()) {
-        if (!max--) break;
-        const iFeedEntry *entry = i.ptr;
-        if (isValid_Time(&entry->discovered) && isUnread_FeedEntry(i.ptr)) {
-            count++;
+    iFeeds *d = &feeds_;
+    lock_Mutex(d->mtx);
+    /* The count only needs updating if the entries or the visited URLs have changed. */
+    const uint32_t visitedGen = generation_Visited(visited_App());
+    if (!d->isNumUnreadValid || d->numUnreadVisitedGen != visitedGen) {
+        size_t count = 0;
+        size_t max = 100; /* match the number of items shown in the sidebar */
+        iConstForEach(Array, i, &d->byTime.values) {
+            if (!max--) break;
+            const iFeedEntry *entry = *(const iFeedEntry **) i.value;
+            if (isValid_Time(&entry->discovered) && isUnread_FeedEntry(entry)) {
+                count++;
+            }
         }
+        d->numUnread           = count;
+        d->numUnreadVisitedGen = visitedGen;
+        d->isNumUnreadValid    = iTrue;
     }
+    const size_t count = d->numUnread;
+    unlock_Mutex(d->mtx);
     return count;
 }
 
@@ -877,7 +1671,7 @@ const iString *entryListPage_Feeds(void) {
     iString *src = collectNew_String();
     setCStr_String(src, translateCStr_Lang("# ${feeds.list.title}\n\n"));
     lock_Mutex(d->mtx);
-    const iPtrArray *subs = listSubscriptions_();
+    const iPtrArray *subs = listSubscriptions_(snapshot_Bookmarks(bookmarks_App()));
     const int elapsed = elapsedSeconds_Time(&d->lastRefreshedAt) / 60;
     appendFormat_String(
         src,
@@ -37,6 +37,7 @@ struct Impl_FeedEntry {
     iString title;
     iBool isHeading; /* URL fragment points to a heading */
     uint32_t bookmarkId; /* note: runtime only, not a persistent ID */
+    uint32_t textId; /* note: runtime only; text index slot plus one, or zero */
 };
 
 iLocalDef iBool isHidden_FeedEntry(const iFeedEntry *d) {
@@ -53,11 +54,13 @@ void    deinit_Feeds            (void);
 void    refresh_Feeds           (void);
 void    setRefreshInterval_Feeds(enum iFeedInterval feedInterval);
 void    refreshFinished_Feeds   (void); /* called on "feeds.refresh.finished" */
+void    loadFinished_Feeds      (void); /* called on "feeds.update.loaded" */
 void    removeEntries_Feeds     (uint32_t feedBookmarkId);
 void    markEntryAsRead_Feeds   (uint32_t feedBookmarkId, const iString *entryUrl, iBool isRead);
 iBool   isUnreadEntry_Feeds     (uint32_t feedBookmarkId, const iString *entryUrl);
 
 const iPtrArray *   listEntries_Feeds   (void);
+const iPtrArray *   listMatchingEntries_Feeds   (const iString *term); /* may contain the words of `term` */
 const iString *     entryListPage_Feeds (void);
 size_t              numSubscribed_Feeds (void);
 size_t              numUnread_Feeds     (void);
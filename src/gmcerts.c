@@ -25,18 +25,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "defs.h"
 #include "app.h"
 
+#include <the_Foundation/atomic.h>
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/fileinfo.h>
+#include <the_Foundation/hash.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/stringarray.h>
 #include <the_Foundation/stringhash.h>
 #include <the_Foundation/stringlist.h>
+#include <the_Foundation/thread.h>
 #include <the_Foundation/time.h>
 #include <ctype.h>
 
 static const char *trustedFilename_GmCerts_   = "trusted.2.txt";
+static const char *tempTrustedFilename_GmCerts_ = "trusted.2.txt.tmp";
 static const char *identsDir_GmCerts_         = "idents";
 static const char *oldIdentsFilename_GmCerts_ = "idents.binary";
 static const char *identsFilename_GmCerts_    = "idents.lgr";
@@ -66,6 +71,12 @@ iDefineClass(TrustEntry)
 
 /*----------------------------------------------------------------------------------------------*/
 
+static iAtomicInt identityGeneration_; /* incremented when fingerprints or use-URLs change */
+
+static void invalidateIndex_GmIdentity_(void) {
+    add_Atomic(&identityGeneration_, 1);
+}
+
 static int cmpUrl_GmIdentity_(const iString *a, const iString *b) {
     return cmpStringCase_String(a, b);
 }
@@ -120,6 +131,7 @@ static void setCertificate_GmIdentity_(iGmIdentity *d, iTlsCertificate *cert) {
     delete_TlsCertificate(d->cert);
     d->cert = cert;
     set_Block(&d->fingerprint, collect_Block(fingerprint_TlsCertificate(cert)));
+    invalidateIndex_GmIdentity_();
 }
 
 static const iString *readFile_(const iString *path) {
@@ -184,6 +196,7 @@ void setUse_GmIdentity(iGmIdentity *d, const iString *url, iBool use) {
     if (use && isUsedOn_GmIdentity(d, url)) {
         return; /* Redudant. */
     }
+    invalidateIndex_GmIdentity_();
     if (use) {
         /* Remove all use-URLs that become redundant by this newly added URL. */
         /* TODO: StringSet could have a non-const iterator. */
@@ -213,6 +226,7 @@ void setUse_GmIdentity(iGmIdentity *d, const iString *url, iBool use) {
 
 void clearUse_GmIdentity(iGmIdentity *d) {
     clear_StringSet(d->useUrls);
+    invalidateIndex_GmIdentity_();
 }
 
 const iString *findUse_GmIdentity(const iGmIdentity *d, const iString *url) {
@@ -237,13 +251,137 @@ iDefineTypeConstruction(GmIdentity)
 
 /*-----------------------------------------------------------------------------------------------*/
 
+iDeclareType(IdentityJob)
+
+static void delete_IdentityJob_(iIdentityJob *);
+
 struct Impl_GmCerts {
     iMutex *mtx;
     iString saveDir;
     iStringHash *trusted;
+    iString trustJournal; /* updated lines not yet appended to the trusted file */
+    size_t numTrustJournaled; /* appended lines since the file was last fully written */
     iPtrArray idents;
+    iHash fingerIndex; /* IdentityKeys for finding identities by fingerprint */
+    iArray useTrie; /* UseTrieNodes of lowercase use-URLs; first node is the root */
+    int indexGeneration; /* identityGeneration_ when the index was last built */
+    iPtrArray jobs; /* IdentityJobs whose certificate is being generated */
+    uint32_t lastJobId;
+    iHash verified; /* VerifyResults of recently checked server certificates */
+    uint32_t verifyCounter;
 };
 
+/* Identities are indexed by fingerprint and by use-URL. Use-URLs and certificates can be
+   modified without access to GmCerts, so the index is rebuilt when needed if anything has
+   changed since it was built. */
+
+iDeclareType(IdentityKey)
+iDeclareType(UseTrieNode)
+
+struct Impl_IdentityKey {
+    iHashNode     node; /* key is a CRC of the fingerprint */
+    iGmIdentity * ident;
+    iIdentityKey *next; /* another identity with the same key */
+};
+
+struct Impl_UseTrieNode {
+    char     ch; /* lowercase URL byte */
+    uint32_t child;
+    uint32_t sibling;
+    const iGmIdentity *ident; /* use-URL ends at this node */
+};
+
+static uint32_t fingerKey_GmCerts_(const iBlock *fingerprint) {
+    return iCrc32(constData_Block(fingerprint), size_Block(fingerprint));
+}
+
+static void clearIndex_GmCerts_(iGmCerts *d) {
+    iForEach(Hash, i, &d->fingerIndex) {
+        iIdentityKey *key = (iIdentityKey *) i.value;
+        remove_HashIterator(&i);
+        while (key) {
+            iIdentityKey *next = key->next;
+            free(key);
+            key = next;
+        }
+    }
+    clear_Array(&d->useTrie);
+    pushBack_Array(&d->useTrie, &(iUseTrieNode){ 0 }); /* root */
+}
+
+static void insertUse_GmCerts_(iGmCerts *d, const iString *url, const iGmIdentity *ident) {
+    uint32_t node = 0;
+    for (const char *ch = constBegin_String(url); ch != constEnd_String(url); ch++) {
+        const char lower = (char) tolower((uint8_t) *ch);
+        uint32_t   child = ((const iUseTrieNode *) constAt_Array(&d->useTrie, node))->child;
+        while (child && ((const iUseTrieNode *) constAt_Array(&d->useTrie, child))->ch != lower) {
+            child = ((const iUseTrieNode *) constAt_Array(&d->useTrie, child))->sibling;
+        }
+        if (!child) {
+            iUseTrieNode *parent = at_Array(&d->useTrie, node);
+            const iUseTrieNode new = { .ch = lower, .sibling = parent->child };
+            child = parent->child = size_Array(&d->useTrie);
+            pushBack_Array(&d->useTrie, &new);
+        }
+        node = child;
+    }
+    iUseTrieNode *end = at_Array(&d->useTrie, node);
+    if (node && !end->ident) {
+        end->ident = ident; /* the first identity using the URL wins */
+    }
+}
+
+static void validateIndex_GmCerts_(iGmCerts *d) {
+    /* Caller must hold the mutex. */
+    const int gen = value_Atomic(&identityGeneration_);
+    if (d->indexGeneration == gen) {
+        return;
+    }
+    clearIndex_GmCerts_(d);
+    iForEach(PtrArray, i, &d->idents) {
+        iGmIdentity *ident = i.ptr;
+        if (!isEmpty_Block(&ident->fingerprint)) {
+            iIdentityKey *key = iMalloc(IdentityKey);
+            key->node.key = fingerKey_GmCerts_(&ident->fingerprint);
+            key->ident    = ident;
+            key->next     = (iIdentityKey *) remove_Hash(&d->fingerIndex, key->node.key);
+            insert_Hash(&d->fingerIndex, &key->node);
+        }
+        iConstForEach(StringSet, j, ident->useUrls) {
+            insertUse_GmCerts_(d, j.value, ident);
+        }
+    }
+    d->indexGeneration = gen;
+}
+
+static const iGmIdentity *findUse_GmCerts_(const iGmCerts *d, iRangecc scheme, iRangecc rest) {
+    /* Caller must hold the mutex. Returns the identity with the longest use-URL that
+       is a case-insensitive prefix of `scheme` followed by `rest`. */
+    const iGmIdentity *found = NULL;
+    uint32_t           node  = 0;
+    for (int part = 0; part < 2; part++) {
+        const iRangecc range = (part == 0 ? scheme : rest);
+        for (const char *ch = range.start; ch < range.end; ch++) {
+            const char lower = (char) tolower((uint8_t) *ch);
+            const iUseTrieNode *child = NULL;
+            for (node = ((const iUseTrieNode *) constAt_Array(&d->useTrie, node))->child; node;
+                 node = child->sibling) {
+                child = constAt_Array(&d->useTrie, node);
+                if (child->ch == lower) {
+                    break;
+                }
+            }
+            if (!node) {
+                return found;
+            }
+            if (child->ident) {
+                found = child->ident;
+            }
+        }
+    }
+    return found;
+}
+
 static const char *magicIdMeta_GmCerts_   = "lgL2";
 static const char *magicIdentity_GmCerts_ = "iden";
 
@@ -289,14 +427,65 @@ void saveIdentities_GmCerts(const iGmCerts *d) {
                    cstr_String(tempPath));
 }
 
-static void save_GmCerts_(const iGmCerts *d) {
+static void journalTrust_GmCerts_(iGmCerts *d, const iString *key, const iTrustEntry *trust) {
+    /* Trust is checked during TLS verification, so the file is not written here. Lines are
+       appended to the file later; when loading, the last line of each key wins. */
+    const iBool wasEmpty = isEmpty_String(&d->trustJournal);
+    appendFormat_String(&d->trustJournal,
+                        "%s %llu %s\n",
+                        cstr_String(key),
+                        (unsigned long long) integralSeconds_Time(&trust->validUntil),
+                        cstrCollect_String(hexEncode_Block(&trust->fingerprint)));
+    d->numTrustJournaled++;
+    if (wasEmpty) {
+        postCommand_App("certs.trust.changed");
+    }
+}
+
+void saveTrusted_GmCerts(iGmCerts *d) {
+    iString  lines;
+    iBuffer *all = NULL;
+    init_String(&lines);
+    lock_Mutex(d->mtx);
+    if (isEmpty_String(&d->trustJournal)) {
+        unlock_Mutex(d->mtx);
+        deinit_String(&lines);
+        return;
+    }
+    set_String(&lines, &d->trustJournal);
+    clear_String(&d->trustJournal);
+    if (d->numTrustJournaled > iMax(100u, (unsigned) size_StringHash(d->trusted))) {
+        /* Too many superseded lines; write everything from scratch. */
+        all = new_Buffer();
+        openEmpty_Buffer(all);
+        serialize_GmCerts(d, stream_Buffer(all), NULL);
+        d->numTrustJournaled = 0;
+    }
+    unlock_Mutex(d->mtx);
+    /* File I/O without holding the lock. */
     iBeginCollect();
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, trustedFilename_GmCerts_)));
-    if (open_File(f, writeOnly_FileMode | text_FileMode)) {
-        serialize_GmCerts(d, stream_File(f), NULL);        
+    const iString *path = collect_String(concatCStr_Path(&d->saveDir, trustedFilename_GmCerts_));
+    if (all) {
+        const iString *tempPath =
+            collect_String(concatCStr_Path(&d->saveDir, tempTrustedFilename_GmCerts_));
+        iFile *f = new_File(tempPath);
+        if (open_File(f, writeOnly_FileMode | text_FileMode)) {
+            write_File(f, data_Buffer(all));
+            close_File(f);
+            commitFile_App(cstr_String(path), cstr_String(tempPath));
+        }
+        iRelease(f);
+        iRelease(all);
+    }
+    else {
+        iFile *f = new_File(path);
+        if (open_File(f, append_FileMode | text_FileMode)) {
+            write_File(f, &lines.chars);
+        }
+        iRelease(f);
     }
-    iRelease(f);
     iEndCollect();
+    deinit_String(&lines);
 }
 
 static void loadIdentityFromCertificate_GmCerts_(iGmCerts *d, const iString *crtPath) {
@@ -318,6 +507,7 @@ static void loadIdentityFromCertificate_GmCerts_(iGmCerts *d, const iString *crt
         initCurrent_Date(&today);
         set_String(&ident->notes, collect_String(format_Date(&today, "Imported on %b %d, %Y")));
         pushBack_PtrArray(&d->idents, ident);
+        invalidateIndex_GmIdentity_();
     }
     setCertificate_GmIdentity_(ident, cert);
     delete_Block(finger);
@@ -340,6 +530,7 @@ static void loadIdentityCertsAndDiscardInvalid_GmCerts_(iGmCerts *d) {
         if (!isValid_GmIdentity_(ident)) {
             delete_GmIdentity(ident);
             remove_PtrArrayIterator(&j);
+            invalidateIndex_GmIdentity_();
         }
     }    
 }
@@ -365,6 +556,7 @@ iBool deserializeIdentities_GmCerts(iGmCerts *d, iStream *ins, enum iImportMetho
             if (method == all_ImportMethod ||
                 (method == ifMissing_ImportMethod && !findIdentity_GmCerts(d, &id->fingerprint))) {
                 pushBack_PtrArray(&d->idents, id);
+                invalidateIndex_GmIdentity_();
             }
             else {
                 delete_GmIdentity(id);
@@ -396,13 +588,20 @@ iGmIdentity *findIdentity_GmCerts(iGmCerts *d, const iBlock *fingerprint) {
     if (isEmpty_Block(fingerprint)) {
         return NULL;
     }
-    iForEach(PtrArray, i, &d->idents) {
-        iGmIdentity *ident = i.ptr;
-        if (cmp_Block(fingerprint, &ident->fingerprint) == 0) { /* TODO: could use a hash */
-            return ident;
+    iGmIdentity *found = NULL;
+    lock_Mutex(d->mtx);
+    validateIndex_GmCerts_(d);
+    for (const iIdentityKey *key = (const iIdentityKey *) value_Hash(
+             &d->fingerIndex, fingerKey_GmCerts_(fingerprint));
+         key;
+         key = key->next) {
+        if (cmp_Block(fingerprint, &key->ident->fingerprint) == 0) {
+            found = key->ident;
+            break;
         }
     }
-    return NULL;
+    unlock_Mutex(d->mtx);
+    return found;
 }
 
 iGmIdentity *findIdentityFuzzy_GmCerts(iGmCerts *d, const iString *fuzzy) {
@@ -435,11 +634,14 @@ void deserializeTrusted_GmCerts(iGmCerts *d, iStream *ins, enum iImportMethod me
     iRegExp *      pattern = new_RegExp("([^\\s]+) ([0-9]+) ([a-z0-9]+)", 0);
     const iRangecc src     = range_Block(collect_Block(readAll_Stream(ins)));
     iRangecc       line    = iNullRange;
+    size_t         numLines = 0;
     lock_Mutex(d->mtx);
+    const size_t oldSize = size_StringHash(d->trusted);
     while (nextSplit_Rangecc(src, "\n", &line)) {
         iRegExpMatch m;
         init_RegExpMatch(&m);
         if (matchRange_RegExp(pattern, line, &m)) {
+            numLines++;
             iBeginCollect();
             const iRangecc key   = capturedRange_RegExpMatch(&m, 1);
             const iRangecc until = capturedRange_RegExpMatch(&m, 2);
@@ -460,6 +662,12 @@ void deserializeTrusted_GmCerts(iGmCerts *d, iStream *ins, enum iImportMethod me
             iEndCollect();
         }
     }
+    if (method == all_ImportMethod) {
+        /* Later lines for the same key supersede earlier ones. When loading the trusted
+           file, these count towards compacting it like lines appended in this session. */
+        const size_t numAdded = size_StringHash(d->trusted) - oldSize;
+        d->numTrustJournaled += numLines - iMin(numLines, numAdded);
+    }
     unlock_Mutex(d->mtx);
     iRelease(pattern);
 }
@@ -495,20 +703,41 @@ void init_GmCerts(iGmCerts *d, const char *saveDir) {
     d->mtx = new_Mutex();
     initCStr_String(&d->saveDir, saveDir);
     d->trusted = new_StringHash();
+    init_String(&d->trustJournal);
+    d->numTrustJournaled = 0;
     init_PtrArray(&d->idents);
+    init_Hash(&d->fingerIndex);
+    init_Array(&d->useTrie, sizeof(iUseTrieNode));
+    d->indexGeneration = value_Atomic(&identityGeneration_) - 1;
+    init_PtrArray(&d->jobs);
+    d->lastJobId = 0;
+    init_Hash(&d->verified);
+    d->verifyCounter = 0;
     load_GmCerts_(d);
     setVerifyFunc_TlsRequest(verify_GmCerts_);
 }
 
 void deinit_GmCerts(iGmCerts *d) {
     setVerifyFunc_TlsRequest(NULL);
+    /* Identities that are still being generated are discarded. */
+    iForEach(PtrArray, j, &d->jobs) {
+        delete_IdentityJob_(j.ptr);
+    }
+    deinit_PtrArray(&d->jobs);
+    saveTrusted_GmCerts(d);
     iGuardMutex(d->mtx, {
         saveIdentities_GmCerts(d);
         iForEach(PtrArray, i, &d->idents) {
             delete_GmIdentity(i.ptr);
         }
         deinit_PtrArray(&d->idents);
+        clearIndex_GmCerts_(d);
+        deinit_Hash(&d->fingerIndex);
+        clearVerified_GmCerts_(d);
+        deinit_Hash(&d->verified);
+        deinit_Array(&d->useTrie);
         iRelease(d->trusted);
+        deinit_String(&d->trustJournal);
         deinit_String(&d->saveDir);
     });
     delete_Mutex(d->mtx);
@@ -543,6 +772,99 @@ iBool verifyDomain_GmCerts(const iTlsCertificate *cert, iRangecc domain) {
     return iFalse;
 }
 
+/*----------------------------------------------------------------------------------------------*/
+
+/* Servers present the same certificate on every connection, so the results of CA chain and
+   domain verification are remembered for a while. Trust-on-first-use is still checked
+   every time. */
+
+iDeclareType(VerifyResult)
+
+#define maxVerified_GmCerts_        256
+#define verifiedLifetime_GmCerts_   3600.0 /* seconds */
+
+struct Impl_VerifyResult {
+    iHashNode node; /* key is a CRC of `fingerprint` and `trustKey` */
+    iBlock    fingerprint; /* of the entire certificate */
+    iString   trustKey;
+    iTime     checkedAt;
+    uint32_t  lastUsed; /* for evicting the least recently used result */
+    iBool     isCATrusted;
+    iBool     isDomainValid;
+};
+
+static void delete_VerifyResult_(iVerifyResult *d) {
+    deinit_Block(&d->fingerprint);
+    deinit_String(&d->trustKey);
+    free(d);
+}
+
+static uint32_t verifyKey_GmCerts_(const iBlock *fingerprint, const iString *trustKey) {
+    return iCrc32(constData_Block(fingerprint), size_Block(fingerprint)) * 31 +
+           iCrc32(cstr_String(trustKey), size_String(trustKey));
+}
+
+static void clearVerified_GmCerts_(iGmCerts *d) {
+    iForEach(Hash, i, &d->verified) {
+        iVerifyResult *res = (iVerifyResult *) i.value;
+        remove_HashIterator(&i);
+        delete_VerifyResult_(res);
+    }
+}
+
+static iBool findVerified_GmCerts_(iGmCerts *d, const iBlock *fingerprint, const iString *trustKey,
+                                   iBool *isCATrusted, iBool *isDomainValid) {
+    /* Caller must hold the mutex. */
+    iVerifyResult *res =
+        (iVerifyResult *) value_Hash(&d->verified, verifyKey_GmCerts_(fingerprint, trustKey));
+    if (!res || !equal_String(&res->trustKey, trustKey) ||
+        cmp_Block(&res->fingerprint, fingerprint)) {
+        return iFalse;
+    }
+    if (elapsedSeconds_Time(&res->checkedAt) > verifiedLifetime_GmCerts_) {
+        remove_Hash(&d->verified, res->node.key);
+        delete_VerifyResult_(res);
+        return iFalse;
+    }
+    res->lastUsed  = ++d->verifyCounter;
+    *isCATrusted   = res->isCATrusted;
+    *isDomainValid = res->isDomainValid;
+    return iTrue;
+}
+
+static void insertVerified_GmCerts_(iGmCerts *d, const iBlock *fingerprint, const iString *trustKey,
+                                    iBool isCATrusted, iBool isDomainValid) {
+    /* Caller must hold the mutex. */
+    const uint32_t key = verifyKey_GmCerts_(fingerprint, trustKey);
+    if (!contains_Hash(&d->verified, key) && size_Hash(&d->verified) >= maxVerified_GmCerts_) {
+        iVerifyResult *oldest = NULL;
+        iConstForEach(Hash, i, &d->verified) {
+            iVerifyResult *res = (iVerifyResult *) i.value;
+            if (!oldest || res->lastUsed < oldest->lastUsed) {
+                oldest = res;
+            }
+        }
+        remove_Hash(&d->verified, oldest->node.key);
+        delete_VerifyResult_(oldest);
+    }
+    iVerifyResult *res = iMalloc(VerifyResult);
+    res->node.key = key;
+    initCopy_Block(&res->fingerprint, fingerprint);
+    initCopy_String(&res->trustKey, trustKey);
+    initCurrent_Time(&res->checkedAt);
+    res->lastUsed      = ++d->verifyCounter;
+    res->isCATrusted   = isCATrusted;
+    res->isDomainValid = isDomainValid;
+    iVerifyResult *old = (iVerifyResult *) insert_Hash(&d->verified, &res->node);
+    if (old) {
+        delete_VerifyResult_(old);
+    }
+}
+
+void resetVerified_GmCerts(iGmCerts *d) {
+    iGuardMutex(d->mtx, clearVerified_GmCerts_(d));
+}
+
 static void makeTrustKey_(iRangecc domain, uint16_t port, iString *key_out) {
     punyEncodeDomain_Rangecc(domain, key_out);
     appendFormat_String(key_out, ";%u", port ? port : GEMINI_DEFAULT_PORT);    
@@ -552,18 +874,32 @@ iBool checkTrust_GmCerts(iGmCerts *d, iRangecc domain, uint16_t port, const iTls
     if (!cert) {
         return iFalse;
     }
+    iString key;
+    init_String(&key);
+    makeTrustKey_(domain, port, &key);
     /* We trust CA verification implicitly. */
-    const iBool isCATrusted   = (verify_TlsCertificate(cert) == authority_TlsCertificateVerifyStatus);
-    const iBool isDomainValid = verifyDomain_GmCerts(cert, domain);
+    iBool   isCATrusted   = iFalse;
+    iBool   isDomainValid = iFalse;
+    iBlock *certFinger    = fingerprint_TlsCertificate(cert);
+    lock_Mutex(d->mtx);
+    const iBool isVerified =
+        findVerified_GmCerts_(d, certFinger, &key, &isCATrusted, &isDomainValid);
+    unlock_Mutex(d->mtx);
+    if (!isVerified) {
+        /* Chain verification is done without holding the lock. */
+        isCATrusted   = (verify_TlsCertificate(cert) == authority_TlsCertificateVerifyStatus);
+        isDomainValid = verifyDomain_GmCerts(cert, domain);
+    }
     /* TODO: Could call setTrusted_GmCerts() instead of duplicating the trust-setting. */
     /* Good certificate. If not already trusted, add it now. */
     iDate until;
     validUntil_TlsCertificate(cert, &until);
     iBlock *fingerprint = publicKeyFingerprint_TlsCertificate(cert);
-    iString key;
-    init_String(&key);
-    makeTrustKey_(domain, port, &key);
     lock_Mutex(d->mtx);
+    if (!isVerified) {
+        insertVerified_GmCerts_(d, certFinger, &key, isCATrusted, isDomainValid);
+    }
+    delete_Block(certFinger);
     iBool ok = isDomainValid && !isExpired_TlsCertificate(cert);
     iTrustEntry *trust = value_StringHash(d->trusted, &key);
     if (trust) {
@@ -589,11 +925,11 @@ iBool checkTrust_GmCerts(iGmCerts *d, iRangecc domain, uint16_t port, const iTls
     }
     else {
         if (ok) {
-            insert_StringHash(d->trusted, &key, iClob(new_TrustEntry(fingerprint, &until)));
+            insert_StringHash(d->trusted, &key, iClob(trust = new_TrustEntry(fingerprint, &until)));
         }
     }
     if (ok) {
-        save_GmCerts_(d);
+        journalTrust_GmCerts_(d, &key, trust);
     }
     unlock_Mutex(d->mtx);
     delete_Block(fingerprint);
@@ -615,7 +951,7 @@ void setTrusted_GmCerts(iGmCerts *d, iRangecc domain, uint16_t port, const iBloc
     else {
         insert_StringHash(d->trusted, &key, iClob(trust = new_TrustEntry(fingerprint, validUntil)));
     }
-    save_GmCerts_(d);
+    journalTrust_GmCerts_(d, &key, trust);
     unlock_Mutex(d->mtx);
     deinit_String(&key);
 }
@@ -648,27 +984,17 @@ const iGmIdentity *identityForUrl_GmCerts(const iGmCerts *d, const iString *url)
     if (isEmpty_String(url)) {
         return NULL;
     }
+    iGmCerts *m = iConstCast(iGmCerts *, d);
     lock_Mutex(d->mtx);
-    const iGmIdentity *found = NULL;
-    iConstForEach(PtrArray, i, &d->idents) {
-        const iGmIdentity *ident = i.ptr;
-        iConstForEach(StringSet, j, ident->useUrls) {
-            const iString *used = j.value;
-            if (startsWithCase_String(url, cstr_String(used))) {
-                found = ident;
-                goto done;
-            }
-        }
-    }
-done:
-    unlock_Mutex(d->mtx);
-    /* Fallback: Titan URLs use the Gemini identities, if not otherwise specified. */
+    validateIndex_GmCerts_(m);
+    const iGmIdentity *found = findUse_GmCerts_(d, iNullRange, range_String(url));
     if (!found && startsWithCase_String(url, "titan://")) {
-        iString *mod = copy_String(url);
-        remove_Block(&mod->chars, 0, 5);
-        prependCStr_String(mod, "gemini");
-        found = identityForUrl_GmCerts(d, collect_String(mod));
+        /* Fallback: Titan URLs use the Gemini identities, if not otherwise specified. */
+        found = findUse_GmCerts_(d,
+                                 range_CStr("gemini"),
+                                 (iRangecc){ constBegin_String(url) + 5, constEnd_String(url) });
     }
+    unlock_Mutex(d->mtx);
     return found;
 }
 
@@ -691,13 +1017,17 @@ static iGmIdentity *add_GmCerts_(iGmCerts *d, iTlsCertificate *cert, int flags)
             return NULL;
         }
     }
-    iGuardMutex(d->mtx, pushBack_PtrArray(&d->idents, id));
+    iGuardMutex(d->mtx, {
+        pushBack_PtrArray(&d->idents, id);
+        invalidateIndex_GmIdentity_();
+    });
     return id;
 }
 
-iGmIdentity *newIdentity_GmCerts(iGmCerts *d, int flags, iDate validUntil, const iString *commonName,
-                                 const iString *email, const iString *userId, const iString *domain,
-                                 const iString *org, const iString *country) {
+static iTlsCertificate *newCertificate_GmCerts_(iDate validUntil, const iString *commonName,
+                                                const iString *email, const iString *userId,
+                                                const iString *domain, const iString *org,
+                                                const iString *country) {
     /* Note: RFC 5280 defines a self-signed CA certificate as also being self-issued, so
        to honor this definition we set the issuer and the subject to be fully equivalent. */
     const iTlsCertificateName names[] = {
@@ -715,7 +1045,115 @@ iGmIdentity *newIdentity_GmCerts(iGmCerts *d, int flags, iDate validUntil, const
         { subjectCountry_TlsCertificateNameType,      !isEmpty_String(country) ? country : NULL },
         { 0, NULL }
     };
-    return add_GmCerts_(d, newSelfSignedRSA_TlsCertificate(2048, validUntil, names), flags);
+    return newSelfSignedRSA_TlsCertificate(2048, validUntil, names);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+enum iIdentityJobName {
+    commonName_IdentityJobName,
+    email_IdentityJobName,
+    userId_IdentityJobName,
+    domain_IdentityJobName,
+    org_IdentityJobName,
+    country_IdentityJobName,
+    max_IdentityJobName
+};
+
+struct Impl_IdentityJob {
+    uint32_t         id;
+    iThread *        thread;
+    int              flags;
+    iDate            validUntil;
+    iString          names[max_IdentityJobName];
+    iString          useUrl;
+    iTlsCertificate *cert; /* result */
+};
+
+static iThreadResult generate_IdentityJob_(iThread *thread) {
+    iIdentityJob *d = userData_Thread(thread);
+    /* Generating an RSA key pair may take a while on slow CPUs. */
+    d->cert = newCertificate_GmCerts_(d->validUntil,
+                                      &d->names[commonName_IdentityJobName],
+                                      &d->names[email_IdentityJobName],
+                                      &d->names[userId_IdentityJobName],
+                                      &d->names[domain_IdentityJobName],
+                                      &d->names[org_IdentityJobName],
+                                      &d->names[country_IdentityJobName]);
+    postCommandf_App("ident.generated id:%u", d->id);
+    return 0;
+}
+
+static void delete_IdentityJob_(iIdentityJob *d) {
+    join_Thread(d->thread);
+    iRelease(d->thread);
+    iForIndices(i, d->names) {
+        deinit_String(&d->names[i]);
+    }
+    deinit_String(&d->useUrl);
+    if (d->cert) {
+        delete_TlsCertificate(d->cert);
+    }
+    free(d);
+}
+
+uint32_t generateIdentity_GmCerts(iGmCerts *d, int flags, iDate validUntil,
+                                  const iString *commonName, const iString *email,
+                                  const iString *userId, const iString *domain,
+                                  const iString *org, const iString *country,
+                                  const iString *useUrl) {
+    iIdentityJob *job = iMalloc(IdentityJob);
+    job->id         = ++d->lastJobId;
+    job->flags      = flags;
+    job->validUntil = validUntil;
+    const iString *names[max_IdentityJobName] = {
+        commonName, email, userId, domain, org, country
+    };
+    iForIndices(i, names) {
+        if (names[i]) {
+            initCopy_String(&job->names[i], names[i]);
+        }
+        else {
+            init_String(&job->names[i]);
+        }
+    }
+    if (useUrl) {
+        initCopy_String(&job->useUrl, useUrl);
+    }
+    else {
+        init_String(&job->useUrl);
+    }
+    job->cert   = NULL;
+    job->thread = new_Thread(generate_IdentityJob_);
+    setUserData_Thread(job->thread, job);
+    pushBack_PtrArray(&d->jobs, job);
+    start_Thread(job->thread);
+    return job->id;
+}
+
+iGmIdentity *finishIdentity_GmCerts(iGmCerts *d, uint32_t jobId) {
+    iForEach(PtrArray, i, &d->jobs) {
+        iIdentityJob *job = i.ptr;
+        if (job->id == jobId) {
+            remove_PtrArrayIterator(&i);
+            join_Thread(job->thread);
+            iGmIdentity *ident = NULL;
+            if (job->cert && !isEmpty_TlsCertificate(job->cert)) {
+                ident = add_GmCerts_(d, job->cert, job->flags);
+                job->cert = NULL; /* taken by the identity */
+                if (ident && !isEmpty_String(&job->useUrl)) {
+                    signIn_GmCerts(d, ident, &job->useUrl);
+                }
+            }
+            delete_IdentityJob_(job);
+            return ident;
+        }
+    }
+    return NULL;
+}
+
+size_t numPendingIdentities_GmCerts(const iGmCerts *d) {
+    return size_PtrArray(&d->jobs);
 }
 
 void importIdentity_GmCerts(iGmCerts *d, iTlsCertificate *cert, const iString *notes) {
@@ -740,6 +1178,7 @@ void deleteIdentity_GmCerts(iGmCerts *d, iGmIdentity *identity) {
         remove(format_CStr("%s.key", filename));
     }
     removeOne_PtrArray(&d->idents, identity);
+    invalidateIndex_GmIdentity_();
     collect_GmIdentity(identity);
     unlock_Mutex(d->mtx);
 }
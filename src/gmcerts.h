@@ -67,27 +67,35 @@ iBool               checkTrust_GmCerts      (iGmCerts *, iRangecc domain, uint16
 void                setTrusted_GmCerts      (iGmCerts *, iRangecc domain, uint16_t port,
                                              const iBlock *fingerprint, const iDate *validUntil);
 iTime               domainValidUntil_GmCerts(const iGmCerts *, iRangecc domain, uint16_t port);
+void                resetVerified_GmCerts   (iGmCerts *); /* call when CA certificates change */
 
 /**
- * Create a new self-signed TLS client certificate for identifying the user.
- * @a commonName and the other name parameters are inserted in the subject field
- * of the certificate.
+ * Start generating a new self-signed TLS client certificate for identifying the user.
+ * The key is generated in a background thread. @a commonName and the other name parameters
+ * are inserted in the subject field of the certificate. When the certificate is ready,
+ * "ident.generated id:N" is posted and finishIdentity_GmCerts() must be called to add
+ * the identity.
  *
  * @param flags       Identity flags. A temporary identity is not saved persistently and
  *                    will be erased when the application is shut down.
  * @param validUntil  Expiration date. Must be in the future.
+ * @param useUrl      Optional URL where the new identity will be signed in.
  *
- * @returns Created identity. GmCerts retains ownership of returned object.
+ * @returns Job ID for finishIdentity_GmCerts().
  */
-iGmIdentity *       newIdentity_GmCerts     (iGmCerts *, int flags, iDate validUntil,
+uint32_t            generateIdentity_GmCerts(iGmCerts *, int flags, iDate validUntil,
                                              const iString *commonName, const iString *email,
                                              const iString *userId, const iString *domain,
-                                             const iString *org, const iString *country);
+                                             const iString *org, const iString *country,
+                                             const iString *useUrl);
+iGmIdentity *       finishIdentity_GmCerts  (iGmCerts *, uint32_t jobId); /* called on "ident.generated" */
+size_t              numPendingIdentities_GmCerts    (const iGmCerts *);
 
 void                importIdentity_GmCerts  (iGmCerts *, iTlsCertificate *cert,
                                              const iString *notes); /* takes ownership */
 void                deleteIdentity_GmCerts  (iGmCerts *, iGmIdentity *identity);
 void                saveIdentities_GmCerts  (const iGmCerts *);
+void                saveTrusted_GmCerts     (iGmCerts *); /* called on "certs.trust.changed" */
 void                serialize_GmCerts       (const iGmCerts *, iStream *trusted, iStream *identsMeta);
 void                deserializeTrusted_GmCerts      (iGmCerts *, iStream *ins, enum iImportMethod method);
 iBool               deserializeIdentities_GmCerts   (iGmCerts *, iStream *ins, enum iImportMethod method);
@@ -57,6 +57,7 @@ struct Impl_GmLink {
     iRangecc urlRange; /* URL in the source */
     iRangecc labelRange; /* label in the source */
     iRangecc labelIcon; /* special icon defined in the label text */
+    uint32_t urlHash; /* for looking up the visit time */
     iTime when;
     int flags;
 };
@@ -65,6 +66,7 @@ void init_GmLink(iGmLink *d) {
     init_String(&d->url);
     d->urlRange = iNullRange;
     d->labelRange = iNullRange;
+    d->urlHash = 0;
     iZap(d->when);
     d->flags = 0;
 }
@@ -458,9 +460,12 @@ static iRangecc addLink_GmDocument_(iGmDocument *d, iRangecc line, iGmLinkId *li
         }
     }
     if (link) {
-        /* Check if visited. */
+        /* Check if visited. The URL is already in canonical form. */
+        link->urlHash = urlHash_Visited(&link->url);
         if (cmpString_String(&link->url, &d->url)) {
-            link->when = urlVisitTime_Visited(visited_App(), &link->url);
+            iVisitedQuery query = { .url = &link->url, .hash = link->urlHash };
+            query_Visited(visited_App(), &query, 1);
+            link->when = query.when;
             if (isValid_Time(&link->when)) {
                 link->flags |= visited_GmLinkFlag;
             }
@@ -2517,20 +2522,38 @@ void foldPre_GmDocument(iGmDocument *d, uint16_t preId) {
 }
 
 void updateVisitedLinks_GmDocument(iGmDocument *d) {
+    /* All the unvisited links are checked at once. */
+    iArray queries;
+    iArray queryLinkIds;
+    init_Array(&queries, sizeof(iVisitedQuery));
+    init_Array(&queryLinkIds, sizeof(iGmLinkId));
+    iConstForEach(PtrArray, i, &d->links) {
+        const iGmLink *link = i.ptr;
+        if (~link->flags & visited_GmLinkFlag) {
+            const iVisitedQuery query  = { .url = &link->url, .hash = link->urlHash };
+            const iGmLinkId     linkId = index_PtrArrayConstIterator(&i) + 1;
+            pushBack_Array(&queries, &query);
+            pushBack_Array(&queryLinkIds, &linkId);
+        }
+    }
+    query_Visited(visited_App(), data_Array(&queries), size_Array(&queries));
     iIntSet linkIds;
     init_IntSet(&linkIds);
-    iForEach(PtrArray, i, &d->links) {
-        iGmLink *link = i.ptr;
-        if (~link->flags & visited_GmLinkFlag) {
-            iTime visitTime = urlVisitTime_Visited(visited_App(), &link->url);
-            if (isValid_Time(&visitTime)) {
-                link->flags |= visited_GmLinkFlag;
-                insert_IntSet(&linkIds, index_PtrArrayIterator(&i) + 1);
-            }
+    iConstForEach(Array, q, &queries) {
+        const iVisitedQuery *query = q.value;
+        if (isValid_Time(&query->when)) {
+            const iGmLinkId linkId =
+                value_Array(&queryLinkIds, index_ArrayConstIterator(&q), iGmLinkId);
+            iGmLink *link = at_PtrArray(&d->links, linkId - 1);
+            link->when   = query->when;
+            link->flags |= visited_GmLinkFlag;
+            insert_IntSet(&linkIds, linkId);
         }
     }
     markLinkRunsVisited_GmDocument_(d, &linkIds);
     deinit_IntSet(&linkIds);
+    deinit_Array(&queryLinkIds);
+    deinit_Array(&queries);
 }
 
 size_t numPre_GmDocument(const iGmDocument *d) {
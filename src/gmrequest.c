@@ -100,10 +100,11 @@ iGmResponse *copy_GmResponse(const iGmResponse *d) {
     return copied;
 }
 
-void serialize_GmResponse(const iGmResponse *d, iStream *outs) {
+static void serializeWithBody_GmResponse_(const iGmResponse *d, iStream *outs,
+                                          const iBlock *body) {
     write32_Stream(outs, d->statusCode);
     serialize_String(&d->meta, outs);
-    serialize_Block(&d->body, outs);
+    serialize_Block(body, outs);
     /* TODO: Add certificate fingerprints, but need to bump file version first. */
     write32_Stream(outs, d->certFlags & ~haveFingerprint_GmCertFlag);
     serialize_Date(&d->certValidUntil, outs);
@@ -112,6 +113,17 @@ void serialize_GmResponse(const iGmResponse *d, iStream *outs) {
     serialize_Block(&d->identityFingerprint, outs);
 }
 
+void serialize_GmResponse(const iGmResponse *d, iStream *outs) {
+    serializeWithBody_GmResponse_(d, outs, &d->body);
+}
+
+void serializeHeader_GmResponse(const iGmResponse *d, iStream *outs) {
+    iBlock empty;
+    init_Block(&empty, 0);
+    serializeWithBody_GmResponse_(d, outs, &empty);
+    deinit_Block(&empty);
+}
+
 void deserialize_GmResponse(iGmResponse *d, iStream *ins) {
     d->statusCode = read32_Stream(ins);
     deserialize_String(&d->meta, ins);
@@ -57,6 +57,7 @@ iDeclareTypeConstruction(GmResponse)
 iDeclareTypeSerialization(GmResponse)
 
 iGmResponse *       copy_GmResponse             (const iGmResponse *);
+void                serializeHeader_GmResponse  (const iGmResponse *, iStream *outs); /* body written as empty */
 
 /*----------------------------------------------------------------------------------------------*/
 
@@ -25,23 +25,34 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "app.h"
 
 #include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/hash.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
+#include <the_Foundation/sortedarray.h>
 #include <the_Foundation/stringset.h>
+#include <ctype.h>
 #include <math.h>
 
 static const size_t maxStack_History_ = 50; /* back/forward navigable items */
 
+static void unregisterCache_RecentUrl_(iRecentUrl *);
+
 void init_RecentUrl(iRecentUrl *d) {
     init_String(&d->url);
     d->normScrollY    = 0;
     d->cachedResponse = NULL;
     d->cachedDoc      = NULL;
+    d->cacheId        = 0;
+    d->contentId      = 0;
+    d->pendingSize    = 0;
+    d->isCompressed   = iFalse;
     d->flags          = 0;
     init_Block(&d->setIdentity, 0);
 }
 
 void deinit_RecentUrl(iRecentUrl *d) {
+    unregisterCache_RecentUrl_(d);
     iRelease(d->cachedDoc);
     deinit_String(&d->url);
     delete_GmResponse(d->cachedResponse);
@@ -56,6 +67,9 @@ iRecentUrl *copy_RecentUrl(const iRecentUrl *d) {
     copy->normScrollY    = d->normScrollY;
     copy->cachedResponse = d->cachedResponse ? copy_GmResponse(d->cachedResponse) : NULL;
     copy->cachedDoc      = ref_Object(d->cachedDoc);
+    copy->contentId      = d->contentId;
+    copy->pendingSize    = d->pendingSize;
+    copy->isCompressed   = d->isCompressed;
     copy->flags          = d->flags;
     set_Block(&copy->setIdentity, &d->setIdentity);
     return copy;
@@ -66,18 +80,637 @@ size_t cacheSize_RecentUrl(const iRecentUrl *d) {
     if (d->cachedResponse) {
         size += size_String(&d->cachedResponse->meta);
         size += size_Block(&d->cachedResponse->body);
+        size += d->pendingSize;
     }
     return size;
 }
 
 size_t memorySize_RecentUrl(const iRecentUrl *d) {
-    size_t size = cacheSize_RecentUrl(d);
+    size_t size = cacheSize_RecentUrl(d) - d->pendingSize;
     if (d->cachedDoc) {
         size += memorySize_GmDocument(d->cachedDoc);
     }
     return size;
 }
 
+static iBool isCompressible_GmResponse_(const iGmResponse *d) {
+    /* Media is already compressed. */
+    return size_Block(&d->body) >= 256 &&
+           (startsWithCase_String(&d->meta, "text/") ||
+            startsWithCase_String(&d->meta, "application/"));
+}
+
+static iBool compress_RecentUrl_(iRecentUrl *d) {
+    /* Cached bodies that are not being displayed are kept compressed. */
+#if defined (iHaveZlib)
+    if (d->cachedResponse && !d->isCompressed && isCompressible_GmResponse_(d->cachedResponse)) {
+        iBlock *zipped = compress_Block(&d->cachedResponse->body);
+        if (size_Block(zipped) < size_Block(&d->cachedResponse->body)) {
+            set_Block(&d->cachedResponse->body, zipped);
+            d->isCompressed = iTrue;
+            d->contentId    = 0;
+        }
+        delete_Block(zipped);
+        return d->isCompressed;
+    }
+#endif
+    iUnused(d);
+    return iFalse;
+}
+
+static iBool decompress_RecentUrl_(iRecentUrl *d) {
+    if (!d->isCompressed) {
+        return iFalse;
+    }
+    d->isCompressed = iFalse;
+    d->contentId    = 0;
+#if defined (iHaveZlib)
+    iBlock *body = decompress_Block(&d->cachedResponse->body);
+    if (body) {
+        set_Block(&d->cachedResponse->body, body);
+        delete_Block(body);
+        return iTrue;
+    }
+#endif
+    /* Can't be restored. */
+    delete_GmResponse(d->cachedResponse);
+    d->cachedResponse = NULL;
+    return iTrue;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+/* All cached responses and documents of all History instances are registered in one place,
+   so the total sizes are always known and trimming can evict the globally least important
+   items without scanning every tab's navigation stack. */
+
+iDeclareType(CacheItem)
+iDeclareType(CacheRegistry)
+iDeclareType(CacheCandidate)
+iDeclareType(ContentWord)
+iDeclareType(ContentPosting)
+
+/* Inverted index of the words in cached text responses. The words are kept sorted so a
+   search term matches all the words it is a prefix of. */
+
+struct Impl_ContentPosting {
+    uint32_t cacheId;
+    uint32_t count; /* occurrences in the response */
+};
+
+struct Impl_ContentWord {
+    iString text;
+    iArray  postings; /* iContentPosting */
+};
+
+static iContentWord *new_ContentWord_(iRangecc text) {
+    iContentWord *d = iMalloc(ContentWord);
+    initRange_String(&d->text, text);
+    init_Array(&d->postings, sizeof(iContentPosting));
+    return d;
+}
+
+static void delete_ContentWord_(iContentWord *d) {
+    deinit_String(&d->text);
+    deinit_Array(&d->postings);
+    free(d);
+}
+
+static int cmp_ContentWordPtr_(const void *a, const void *b) {
+    return cmpString_String(&(*(const iContentWord **) a)->text,
+                            &(*(const iContentWord **) b)->text);
+}
+
+struct Impl_CacheItem {
+    iHashNode node; /* key is RecentUrl's cacheId */
+    iHistory *history;
+    size_t    cacheSize;
+    size_t    memorySize;
+    size_t    docSize; /* measured when the document was last set */
+    iTime     when;    /* time of the cached response, if any */
+    iBool     isIndexed;
+    iPtrArray words;   /* iContentWord * that have a posting for this item */
+};
+
+struct Impl_CacheRegistry {
+    iMutex  *mtx;
+    iHash    items;
+    uint32_t lastId;
+    size_t   cacheSize;
+    size_t   memorySize;
+    iString *contentDir;   /* response bodies are saved here as separate files */
+    iStringSet *savedContent; /* content files referenced by the latest saved state */
+    iSortedArray words;    /* iContentWord *, sorted by text */
+};
+
+struct Impl_CacheCandidate {
+    double   score;
+    uint32_t cacheId;
+};
+
+static iCacheRegistry *cache_History_(void) {
+    static iCacheRegistry reg_;
+    if (!reg_.mtx) {
+        reg_.mtx = new_Mutex();
+        init_Hash(&reg_.items);
+        reg_.lastId     = 0;
+        reg_.cacheSize  = 0;
+        reg_.memorySize = 0;
+        reg_.contentDir   = new_String();
+        reg_.savedContent = new_StringSet();
+        init_SortedArray(&reg_.words, sizeof(iContentWord *), cmp_ContentWordPtr_);
+    }
+    return &reg_;
+}
+
+static const size_t minWordLength_History_ = 2;
+static const size_t maxWordLength_History_ = 40;
+
+static int decodeChar_History_(const char *pos, const char *end, iChar *ch) {
+    /* Returns the length of the UTF-8 sequence. Invalid bytes are skipped one by one. */
+    const int len = decodeBytes_MultibyteChar(pos, end, ch);
+    if (len <= 0) {
+        *ch = 0xfffd;
+        return 1;
+    }
+    return len;
+}
+
+static iBool isWordChar_History_(iChar ch) {
+    return isAlphaNumeric_Char(ch);
+}
+
+static const char *skipChars_History_(const char *pos, const char *end, iBool isWord) {
+    /* Skips over word or non-word characters. */
+    while (pos < end) {
+        iChar     ch;
+        const int len = decodeChar_History_(pos, end, &ch);
+        if (isWordChar_History_(ch) != isWord) {
+            break;
+        }
+        pos += len;
+    }
+    return pos;
+}
+
+static void appendLower_History_(iBlock *out, iChar ch) {
+    if (ch < 0x80) {
+        pushBack_Block(out, (char) tolower((int) ch));
+    }
+    else {
+        iMultibyteChar mb;
+        init_MultibyteChar(&mb, lower_Char(ch));
+        appendCStr_Block(out, mb.bytes);
+    }
+}
+
+static iBlock *lower_History_(iRangecc text) {
+    /* Returns a new block with the text in lower case. */
+    iBlock *lower = new_Block(0);
+    for (const char *pos = text.start; pos < text.end; ) {
+        iChar ch;
+        pos += decodeChar_History_(pos, text.end, &ch);
+        appendLower_History_(lower, ch);
+    }
+    return lower;
+}
+
+static const char *matchLower_History_(const char *pos, const char *end, iRangecc lowerTerm) {
+    /* Returns the end of the match if the text at `pos` begins with the lower case term. */
+    iBlock folded;
+    init_Block(&folded, 0);
+    while (pos < end && size_Block(&folded) < size_Range(&lowerTerm)) {
+        iChar ch;
+        pos += decodeChar_History_(pos, end, &ch);
+        appendLower_History_(&folded, ch);
+    }
+    const iBool isMatch = size_Block(&folded) >= size_Range(&lowerTerm) &&
+                          !memcmp(constData_Block(&folded), lowerTerm.start, size_Range(&lowerTerm));
+    deinit_Block(&folded);
+    return isMatch ? pos : NULL;
+}
+
+static iBool nextWord_History_(iRangecc text, iRangecc *word) {
+    /* `word` must be initialized as a null range. */
+    const char *pos = word->end ? word->end : text.start;
+    for (;;) {
+        pos = skipChars_History_(pos, text.end, iFalse);
+        if (pos == text.end) {
+            return iFalse;
+        }
+        word->start = pos;
+        pos = skipChars_History_(pos, text.end, iTrue);
+        word->end = pos;
+        const size_t len = size_Range(word);
+        if (len >= minWordLength_History_ && len <= maxWordLength_History_) {
+            return iTrue;
+        }
+    }
+}
+
+static int cmpRange_History_(const void *a, const void *b) {
+    const iRangecc *r1 = a, *r2 = b;
+    const size_t len1 = size_Range(r1), len2 = size_Range(r2);
+    const int cmp = memcmp(r1->start, r2->start, iMin(len1, len2));
+    return cmp ? cmp : iCmp(len1, len2);
+}
+
+static iContentWord *findWord_CacheRegistry_(const iCacheRegistry *d, iRangecc text,
+                                             size_t *pos_out) {
+    iContentWord key;
+    initRange_String(&key.text, text);
+    const iContentWord *keyPtr = &key;
+    const iBool found = locate_SortedArray(&d->words, &keyPtr, pos_out);
+    deinit_String(&key.text);
+    return found ? *(iContentWord **) at_SortedArray(&d->words, *pos_out) : NULL;
+}
+
+static void index_CacheRegistry_(iCacheRegistry *d, iCacheItem *item, const iBlock *lowerText) {
+    item->isIndexed = iTrue;
+    if (!lowerText) {
+        return;
+    }
+    /* Count the occurrences of each word by sorting them. */
+    iArray words;
+    init_Array(&words, sizeof(iRangecc));
+    for (iRangecc word = iNullRange; nextWord_History_(range_Block(lowerText), &word); ) {
+        pushBack_Array(&words, &word);
+    }
+    sort_Array(&words, cmpRange_History_);
+    for (size_t i = 0; i < size_Array(&words); ) {
+        const iRangecc *word = constAt_Array(&words, i);
+        size_t end = i + 1;
+        while (end < size_Array(&words) && !cmpRange_History_(word, constAt_Array(&words, end))) {
+            end++;
+        }
+        size_t pos;
+        iContentWord *cw = findWord_CacheRegistry_(d, *word, &pos);
+        if (!cw) {
+            cw = new_ContentWord_(*word);
+            insert_SortedArray(&d->words, &cw);
+        }
+        pushBack_Array(&cw->postings, &(iContentPosting){ item->node.key, end - i });
+        pushBack_PtrArray(&item->words, cw);
+        i = end;
+    }
+    deinit_Array(&words);
+}
+
+static void unindex_CacheRegistry_(iCacheRegistry *d, iCacheItem *item) {
+    iForEach(PtrArray, i, &item->words) {
+        iContentWord *cw = i.ptr;
+        iForEach(Array, j, &cw->postings) {
+            const iContentPosting *post = j.value;
+            if (post->cacheId == item->node.key) {
+                remove_ArrayIterator(&j);
+                break;
+            }
+        }
+        if (isEmpty_Array(&cw->postings)) {
+            size_t pos;
+            if (findWord_CacheRegistry_(d, range_String(&cw->text), &pos)) {
+                remove_SortedArray(&d->words, pos);
+            }
+            delete_ContentWord_(cw);
+        }
+    }
+    clear_PtrArray(&item->words);
+    item->isIndexed = iFalse;
+}
+
+static void unlinkItem_CacheRegistry_(iCacheRegistry *d, iCacheItem *item) {
+    d->cacheSize  -= item->cacheSize;
+    d->memorySize -= item->memorySize;
+}
+
+static iBool isIndexable_GmResponse_(const iGmResponse *d) {
+    return category_GmStatusCode(d->statusCode) == categorySuccess_GmStatusCode &&
+           startsWithCase_String(&d->meta, "text/");
+}
+
+static iBlock *indexableText_GmResponse_(const iGmResponse *d, const iBlock *body) {
+    /* Returns lower case text, or NULL if the response isn't text. */
+    if (!isIndexable_GmResponse_(d)) {
+        return NULL;
+    }
+    return lower_History_(range_Block(body));
+}
+
+static void unregisterCache_RecentUrl_(iRecentUrl *d) {
+    if (d->cacheId) {
+        iCacheRegistry *reg = cache_History_();
+        lock_Mutex(reg->mtx);
+        iCacheItem *item = (iCacheItem *) remove_Hash(&reg->items, d->cacheId);
+        if (item) {
+            unlinkItem_CacheRegistry_(reg, item);
+            unindex_CacheRegistry_(reg, item);
+            deinit_PtrArray(&item->words);
+            free(item);
+        }
+        unlock_Mutex(reg->mtx);
+        d->cacheId = 0;
+    }
+}
+
+static void registerCache_RecentUrl_(iRecentUrl *d, iHistory *owner) {
+    /* Called after the cached response or document of the item has changed. */
+    if (!d->cachedResponse && !d->cachedDoc) {
+        unregisterCache_RecentUrl_(d);
+        return;
+    }
+    iCacheRegistry *reg = cache_History_();
+    lock_Mutex(reg->mtx);
+    iCacheItem *item = d->cacheId ? (iCacheItem *) value_Hash(&reg->items, d->cacheId) : NULL;
+    if (item) {
+        unlinkItem_CacheRegistry_(reg, item);
+    }
+    else {
+        item = iMalloc(CacheItem);
+        do {
+            d->cacheId = ++reg->lastId;
+        } while (!d->cacheId || contains_Hash(&reg->items, d->cacheId));
+        item->node.key  = d->cacheId;
+        item->isIndexed = iFalse;
+        init_PtrArray(&item->words);
+        insert_Hash(&reg->items, &item->node);
+    }
+    item->history   = owner;
+    item->cacheSize = cacheSize_RecentUrl(d);
+    item->docSize   = d->cachedDoc ? memorySize_GmDocument(d->cachedDoc) : 0;
+    item->memorySize = item->cacheSize - d->pendingSize + item->docSize;
+    if (d->cachedResponse) {
+        item->when = d->cachedResponse->when;
+    }
+    else {
+        iZap(item->when);
+    }
+    reg->cacheSize  += item->cacheSize;
+    reg->memorySize += item->memorySize;
+    if (!item->isIndexed && d->cachedResponse && !d->pendingSize && !d->isCompressed) {
+        iBlock *text = indexableText_GmResponse_(d->cachedResponse, &d->cachedResponse->body);
+        index_CacheRegistry_(reg, item, text);
+        delete_Block(text);
+    }
+    unlock_Mutex(reg->mtx);
+}
+
+static void siftDown_CacheCandidates_(iArray *heap, size_t pos) {
+    /* Max-heap on score. */
+    iCacheCandidate *c = data_Array(heap);
+    const size_t     n = size_Array(heap);
+    for (;;) {
+        size_t top = pos;
+        const size_t left = 2 * pos + 1, right = left + 1;
+        if (left < n && c[left].score > c[top].score) top = left;
+        if (right < n && c[right].score > c[top].score) top = right;
+        if (top == pos) break;
+        iSwap(iCacheCandidate, c[pos], c[top]);
+        pos = top;
+    }
+}
+
+static iBool popCandidate_CacheCandidates_(iArray *heap, uint32_t *cacheId_out) {
+    if (isEmpty_Array(heap)) {
+        return iFalse;
+    }
+    iCacheCandidate *c = data_Array(heap);
+    *cacheId_out = c[0].cacheId;
+    c[0] = c[size_Array(heap) - 1];
+    popBack_Array(heap);
+    siftDown_CacheCandidates_(heap, 0);
+    return iTrue;
+}
+
+static void collectCandidates_CacheRegistry_(iCacheRegistry *d, iBool isMemory, iArray *heap) {
+    /* The age of each item keeps changing, so the scores are evaluated once per trim and
+       heapified in linear time. */
+    iTime now;
+    initCurrent_Time(&now);
+    lock_Mutex(d->mtx);
+    iConstForEach(Hash, i, &d->items) {
+        const iCacheItem *item = (const iCacheItem *) i.value;
+        const iBool hasTime = isValid_Time(&item->when);
+        if (isMemory ? item->docSize == 0 : !hasTime) {
+            continue;
+        }
+        const double age = hasTime ? pow(secondsSince_Time(&now, &item->when) / 60.0, 1.25)
+                                   : 1.0;
+        const size_t size = isMemory ? item->memorySize : item->cacheSize;
+        pushBack_Array(heap, &(iCacheCandidate){ size * age, item->node.key });
+    }
+    unlock_Mutex(d->mtx);
+    for (size_t pos = size_Array(heap) / 2; pos-- > 0; ) {
+        siftDown_CacheCandidates_(heap, pos);
+    }
+}
+
+static iHistory *owner_CacheRegistry_(iCacheRegistry *d, uint32_t cacheId) {
+    iHistory *owner = NULL;
+    lock_Mutex(d->mtx);
+    const iCacheItem *item = (const iCacheItem *) value_Hash(&d->items, cacheId);
+    if (item) {
+        owner = item->history;
+    }
+    unlock_Mutex(d->mtx);
+    return owner;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+/* Response bodies are saved in the content store, one file per body, so the state file
+   itself only needs an index of the navigation stacks. A body is loaded from its file when
+   the item is navigated to. The files are named by a 64-bit hash and the size of the
+   contents, so unchanged bodies don't have to be rewritten when the state is saved again.
+   Each file begins with a header that has a CRC-32 of the body, and both checksums are
+   verified when the body is read back. */
+
+static const char *magicContent_History_ = "lgC1";
+
+static uint64_t contentHash_History_(const iBlock *body) {
+    /* FNV-1a, 64-bit. */
+    const uint8_t *data = constData_Block(body);
+    uint64_t       hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size_Block(body); i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return iMax(1u, hash);
+}
+
+static const iString *contentName_History_(uint64_t contentId, size_t size) {
+    return collectNewFormat_String("%016llx%08x", (unsigned long long) contentId, (uint32_t) size);
+}
+
+static const char *contentPath_History_(uint64_t contentId, size_t size) {
+    const iCacheRegistry *reg = cache_History_();
+    return concatPath_CStr(cstr_String(reg->contentDir),
+                           cstr_String(contentName_History_(contentId, size)));
+}
+
+static iBool writeContent_History_(const char *path, const iBlock *body) {
+    iFile *f  = newCStr_File(path);
+    iBool  ok = iFalse;
+    if (open_File(f, writeOnly_FileMode)) {
+        iStream *outs = stream_File(f);
+        writeData_Stream(outs, magicContent_History_, 4);
+        writeU32_Stream(outs, size_Block(body));
+        writeU32_Stream(outs, iCrc32(constData_Block(body), size_Block(body)));
+        ok = (writeData_Stream(outs, constData_Block(body), size_Block(body)) ==
+              size_Block(body));
+    }
+    iRelease(f);
+    if (!ok) {
+        remove(path);
+    }
+    return ok;
+}
+
+static iBool store_RecentUrl_(const iRecentUrl *d, uint64_t *contentId_out, uint32_t *size_out) {
+    iCacheRegistry *reg = cache_History_();
+    if (isEmpty_String(reg->contentDir)) {
+        return iFalse;
+    }
+    if (d->pendingSize) {
+        /* Still the same file that was loaded at startup. */
+        *contentId_out = d->contentId;
+        *size_out      = d->pendingSize;
+    }
+    else {
+        const iBlock *body = &d->cachedResponse->body;
+        if (isEmpty_Block(body)) {
+            return iFalse;
+        }
+        if (!d->contentId) {
+            iConstCast(iRecentUrl *, d)->contentId = contentHash_History_(body);
+        }
+        const char *path = contentPath_History_(d->contentId, size_Block(body));
+        if (!fileExistsCStr_FileInfo(path) && !writeContent_History_(path, body)) {
+            return iFalse;
+        }
+        *contentId_out = d->contentId;
+        *size_out      = size_Block(body);
+    }
+    lock_Mutex(reg->mtx);
+    insert_StringSet(reg->savedContent, contentName_History_(*contentId_out, *size_out));
+    unlock_Mutex(reg->mtx);
+    return iTrue;
+}
+
+static iBlock *readContent_History_(uint64_t contentId, size_t size) {
+    /* Returns NULL if the file is missing, damaged, or has some other contents. */
+    iBlock *body = NULL;
+    iFile  *f    = newCStr_File(contentPath_History_(contentId, size));
+    if (open_File(f, readOnly_FileMode)) {
+        iStream *ins = stream_File(f);
+        char     magic[4];
+        readData_Stream(ins, sizeof(magic), magic);
+        const uint32_t storedSize = readU32_Stream(ins);
+        const uint32_t storedCrc  = readU32_Stream(ins);
+        if (!memcmp(magic, magicContent_History_, sizeof(magic)) && storedSize == size) {
+            body = readAll_Stream(ins);
+            if (size_Block(body) != size ||
+                iCrc32(constData_Block(body), size_Block(body)) != storedCrc ||
+                contentHash_History_(body) != contentId) {
+                delete_Block(body);
+                body = NULL;
+            }
+        }
+    }
+    iRelease(f);
+    return body;
+}
+
+static iBool load_RecentUrl_(iRecentUrl *d) {
+    if (!d->pendingSize) {
+        return iFalse;
+    }
+    iBlock *body = readContent_History_(d->contentId, d->pendingSize);
+    if (body) {
+        set_Block(&d->cachedResponse->body, body);
+        d->pendingSize = 0;
+        delete_Block(body);
+    }
+    if (d->pendingSize) {
+        /* Missing or damaged. */
+        delete_GmResponse(d->cachedResponse);
+        d->cachedResponse = NULL;
+        d->isCompressed   = iFalse;
+        d->contentId      = 0;
+        d->pendingSize    = 0;
+    }
+    return iTrue;
+}
+
+/* The body of a cached response can be read without holding the history's lock. Reading a
+   saved body from its file and decompressing it may take a while. */
+iDeclareType(BodySource)
+
+struct Impl_BodySource {
+    iBlock   data;         /* copy of the body in memory, if already loaded */
+    uint64_t contentId;    /* saved in the content store, if not loaded */
+    uint32_t pendingSize;
+    iBool    isCompressed;
+};
+
+static iBool init_BodySource_(iBodySource *d, const iRecentUrl *url) {
+    /* Caller must hold the history's lock. Returns iFalse if there is no body. */
+    if (!url->cachedResponse) {
+        return iFalse;
+    }
+    init_Block(&d->data, 0);
+    d->contentId    = url->contentId;
+    d->pendingSize  = url->pendingSize;
+    d->isCompressed = url->isCompressed;
+    if (!d->pendingSize) {
+        set_Block(&d->data, &url->cachedResponse->body);
+    }
+    return iTrue;
+}
+
+static void deinit_BodySource_(iBodySource *d) {
+    deinit_Block(&d->data);
+}
+
+static iBlock *read_BodySource_(const iBodySource *d) {
+    /* Returns a copy of the uncompressed body, wherever it is kept at the moment. */
+    iBlock *body = d->pendingSize ? readContent_History_(d->contentId, d->pendingSize)
+                                  : copy_Block(&d->data);
+    if (body && d->isCompressed) {
+#if defined (iHaveZlib)
+        iBlock *inflated = decompress_Block(body);
+        delete_Block(body);
+        body = inflated;
+#else
+        delete_Block(body);
+        body = NULL;
+#endif
+    }
+    return body;
+}
+
+void setContentDir_History(const char *dir) {
+    iCacheRegistry *reg = cache_History_();
+    setCStr_String(reg->contentDir, dir);
+    makeDirs_Path(reg->contentDir);
+}
+
+void purgeContent_History(void) {
+    iCacheRegistry *reg = cache_History_();
+    if (isEmpty_String(reg->contentDir)) {
+        return;
+    }
+    lock_Mutex(reg->mtx);
+    iForEach(DirFileInfo, i, iClob(new_DirFileInfo(reg->contentDir))) {
+        const iString *path = path_FileInfo(i.value);
+        if (!contains_StringSet(reg->savedContent,
+                                collectNewRange_String(baseName_Path(path)))) {
+            remove(cstr_String(path));
+        }
+    }
+    clear_StringSet(reg->savedContent);
+    unlock_Mutex(reg->mtx);
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 struct Impl_History {
@@ -86,6 +719,33 @@ struct Impl_History {
     size_t recentPos; /* zero at the latest item */
 };
 
+static size_t findCached_History_(const iHistory *d, uint32_t cacheId) {
+    iConstForEach(Array, i, &d->recent) {
+        if (((const iRecentUrl *) i.value)->cacheId == cacheId) {
+            return index_ArrayConstIterator(&i);
+        }
+    }
+    return iInvalidPos;
+}
+
+static void updateCompression_History_(iHistory *d) {
+    /* Only the body at the current navigation position is kept uncompressed. */
+    iForEach(Array, i, &d->recent) {
+        iRecentUrl *item = i.value;
+        iBool changed;
+        if (d->recentPos == size_Array(&d->recent) - index_ArrayIterator(&i) - 1) {
+            changed = load_RecentUrl_(item);
+            changed |= decompress_RecentUrl_(item);
+        }
+        else {
+            changed = compress_RecentUrl_(item);
+        }
+        if (changed) {
+            registerCache_RecentUrl_(item, d);
+        }
+    }
+}
+
 iDefineTypeConstruction(History)
 
 void init_History(iHistory *d) {
@@ -106,7 +766,10 @@ iHistory *copy_History(const iHistory *d) {
     lock_Mutex(d->mtx);
     iHistory *copy = new_History();
     iConstForEach(Array, i, &d->recent) {
-        pushBack_Array(&copy->recent, copy_RecentUrl(i.value));
+        iRecentUrl *item = copy_RecentUrl(i.value);
+        pushBack_Array(&copy->recent, item);
+        free(item); /* contents were moved to the array */
+        registerCache_RecentUrl_(back_Array(&copy->recent), copy);
     }
     copy->recentPos = d->recentPos;
     unlock_Mutex(d->mtx);
@@ -176,6 +839,14 @@ iString *debugInfo_History(const iHistory *d) {
     return str;
 }
 
+enum iContentMarker {
+    none_ContentMarker,
+    inline_ContentMarker,
+    compressed_ContentMarker,
+    stored_ContentMarker, /* body is in the content store */
+    storedCompressed_ContentMarker,
+};
+
 void serialize_History(const iHistory *d, iStream *outs) {
     serializeWithContent_History(d, outs, iTrue);
 }
@@ -189,12 +860,23 @@ void serializeWithContent_History(const iHistory *d, iStream *outs, iBool withCo
         serialize_String(&item->url, outs);
         write32_Stream(outs, item->normScrollY * 1.0e6f);
         writeU16_Stream(outs, item->flags);
-        if (withContent && item->cachedResponse) {
-            write8_Stream(outs, 1);
+        uint64_t contentId;
+        uint32_t contentSize;
+        if (withContent && item->cachedResponse &&
+            store_RecentUrl_(item, &contentId, &contentSize)) {
+            write8_Stream(outs, item->isCompressed ? storedCompressed_ContentMarker
+                                                   : stored_ContentMarker);
+            serializeHeader_GmResponse(item->cachedResponse, outs);
+            writeU64_Stream(outs, contentId);
+            writeU32_Stream(outs, contentSize);
+        }
+        else if (withContent && item->cachedResponse) {
+            write8_Stream(outs, item->isCompressed ? compressed_ContentMarker
+                                                   : inline_ContentMarker);
             serialize_GmResponse(item->cachedResponse, outs);
         }
         else {
-            write8_Stream(outs, 0);
+            write8_Stream(outs, none_ContentMarker);
         }
         serialize_Block(&item->setIdentity, outs);
     }
@@ -215,15 +897,27 @@ void deserialize_History(iHistory *d, iStream *ins) {
         if (version_Stream(ins) >= addedRecentUrlFlags_FileVersion) {
             item.flags = readU16_Stream(ins);
         }
-        if (read8_Stream(ins)) {
+        const uint8_t content = read8_Stream(ins);
+        if (content) {
             item.cachedResponse = new_GmResponse();
             deserialize_GmResponse(item.cachedResponse, ins);
+            item.isCompressed = (content == compressed_ContentMarker ||
+                                 content == storedCompressed_ContentMarker);
+            if (content >= stored_ContentMarker) {
+                /* Older content files have no header and will not be found. */
+                item.contentId   = version_Stream(ins) >= contentChecksum_FileVersion
+                                       ? readU64_Stream(ins)
+                                       : readU32_Stream(ins);
+                item.pendingSize = readU32_Stream(ins);
+            }
         }
         if (version_Stream(ins) >= recentUrlSetIdentity_FileVersion) {
             deserialize_Block(&item.setIdentity, ins);
         }
         pushBack_Array(&d->recent, &item);
+        registerCache_RecentUrl_(back_Array(&d->recent), d);
     }
+    /* Content is loaded later when needed. */
     unlock_Mutex(d->mtx);
 }
 
@@ -318,6 +1012,7 @@ void add_History(iHistory *d, const iString *url) {
             remove_Array(&d->recent, 0);
         }
     }
+    updateCompression_History_(d);
     unlock_Mutex(d->mtx);
 }
 
@@ -326,6 +1021,7 @@ void undo_History(iHistory *d) {
     if (!isEmpty_Array(&d->recent) || d->recentPos != 0) {
         deinit_RecentUrl(back_Array(&d->recent));
         popBack_Array(&d->recent);
+        updateCompression_History_(d);
     }
     unlock_Mutex(d->mtx);
 }
@@ -369,6 +1065,7 @@ iBool goBack_History(iHistory *d) {
     lock_Mutex(d->mtx);
     if (!isEmpty_Array(&d->recent) && d->recentPos < size_Array(&d->recent) - 1) {
         d->recentPos++;
+        updateCompression_History_(d);
         postCommandf_Root(get_Root(),
                           "open history:1 scroll:%f url:%s",
                           mostRecentUrl_History(d)->normScrollY,
@@ -384,6 +1081,7 @@ iBool goForward_History(iHistory *d) {
     lock_Mutex(d->mtx);
     if (d->recentPos > 0) {
         d->recentPos--;
+        updateCompression_History_(d);
         const iRecentUrl *recent = constMostRecentUrl_History(d);
         postCommandf_Root(get_Root(),
                           "open history:1 scroll:%f url:%s",
@@ -432,11 +1130,16 @@ void setCachedResponse_History(iHistory *d, const iGmResponse *response) {
     lock_Mutex(d->mtx);
     iRecentUrl *item = mostRecentUrl_History(d);
     if (item) {
+        unregisterCache_RecentUrl_(item); /* new content is indexed separately */
         delete_GmResponse(item->cachedResponse);
         item->cachedResponse = NULL;
+        item->isCompressed   = iFalse;
+        item->contentId      = 0;
+        item->pendingSize    = 0;
         if (category_GmStatusCode(response->statusCode) == categorySuccess_GmStatusCode) {
             item->cachedResponse = copy_GmResponse(response);
         }
+        registerCache_RecentUrl_(item, d);
     }
     unlock_Mutex(d->mtx);
 }
@@ -459,32 +1162,11 @@ void setCachedDocument_History(iHistory *d, iGmDocument *doc) {
             iRelease(item->cachedDoc);
             item->cachedDoc = ref_Object(doc);
         }
+        registerCache_RecentUrl_(item, d); /* document size may have changed */
     }
     unlock_Mutex(d->mtx);
 }
 
-size_t cacheSize_History(const iHistory *d) {
-    size_t cached = 0;
-    lock_Mutex(d->mtx);
-    iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        cached += cacheSize_RecentUrl(url);
-    }
-    unlock_Mutex(d->mtx);
-    return cached;
-}
-
-size_t memorySize_History(const iHistory *d) {
-    size_t bytes = 0;
-    lock_Mutex(d->mtx);
-    iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        bytes += memorySize_RecentUrl(url);
-    }
-    unlock_Mutex(d->mtx);
-    return bytes;
-}
-
 void clearCache_History(iHistory *d) {
     lock_Mutex(d->mtx);
     iForEach(Array, i, &d->recent) {
@@ -492,8 +1174,12 @@ void clearCache_History(iHistory *d) {
         if (url->cachedResponse) {
             delete_GmResponse(url->cachedResponse);
             url->cachedResponse = NULL;
+            url->isCompressed   = iFalse;
+            url->contentId      = 0;
+            url->pendingSize    = 0;
         }
         iReleasePtr(&url->cachedDoc); /* release all cached documents and media as well */
+        unregisterCache_RecentUrl_(url);
     }
     unlock_Mutex(d->mtx);
 }
@@ -509,68 +1195,80 @@ void invalidateCachedLayout_History(iHistory *d) {
     unlock_Mutex(d->mtx);
 }
 
-size_t pruneLeastImportant_History(iHistory *d) {
-    size_t delta  = 0;
-    size_t chosen = iInvalidPos;
-    double score  = 0.0f;
-    iTime now;
-    initCurrent_Time(&now);
+static size_t pruneCached_History_(iHistory *d, uint32_t cacheId, iBool isMemory) {
+    size_t delta = 0;
     lock_Mutex(d->mtx);
-    iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        if (url->cachedResponse) {
-            const double urlScore =
-                cacheSize_RecentUrl(url) *
-                pow(secondsSince_Time(&now, &url->cachedResponse->when) / 60.0, 1.25);
-            if (urlScore > score) {
-                chosen = index_ArrayConstIterator(&i);
-                score  = urlScore;
-            }
+    const size_t index = findCached_History_(d, cacheId);
+    if (index != iInvalidPos) {
+        iRecentUrl *url = at_Array(&d->recent, index);
+        if (!isMemory) {
+            delta = cacheSize_RecentUrl(url);
+            delete_GmResponse(url->cachedResponse);
+            url->cachedResponse = NULL;
+            url->isCompressed   = iFalse;
+            url->contentId      = 0;
+            url->pendingSize    = 0;
+            iReleasePtr(&url->cachedDoc);
+            registerCache_RecentUrl_(url, d);
+        }
+        else if (d->recentPos != size_Array(&d->recent) - index - 1) {
+            /* The document at the current navigation position is kept. */
+            const size_t before = memorySize_RecentUrl(url);
+            iReleasePtr(&url->cachedDoc);
+            delta = before - memorySize_RecentUrl(url);
+            registerCache_RecentUrl_(url, d);
         }
-    }
-    if (chosen != iInvalidPos) {
-        iRecentUrl *url = at_Array(&d->recent, chosen);
-        delta = cacheSize_RecentUrl(url);
-        delete_GmResponse(url->cachedResponse);
-        url->cachedResponse = NULL;
-        iReleasePtr(&url->cachedDoc);
     }
     unlock_Mutex(d->mtx);
     return delta;
 }
 
-size_t pruneLeastImportantMemory_History(iHistory *d) {
-    size_t delta  = 0;
-    size_t chosen = iInvalidPos;
-    double score  = 0.0f;
-    iTime now;
-    initCurrent_Time(&now);
-    lock_Mutex(d->mtx);
-    iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        if (d->recentPos == size_Array(&d->recent) - index_ArrayConstIterator(&i) - 1) {
-            continue; /* Not the current navigation position. */
-        }
-        if (url->cachedDoc) {
-            const double urlScore =
-                memorySize_RecentUrl(url) *
-                (url->cachedResponse
-                     ? pow(secondsSince_Time(&now, &url->cachedResponse->when) / 60.0, 1.25)
-                     : 1.0);
-            if (urlScore > score) {
-                chosen = index_ArrayConstIterator(&i);
-                score  = urlScore;
-            }
-        }
+static size_t prune_History_(size_t limit, iBool isMemory) {
+    iCacheRegistry *reg   = cache_History_();
+    const iMemInfo  usage = totalMemoryUsage_History();
+    size_t          total = isMemory ? usage.memorySize : usage.cacheSize;
+    size_t          freed = 0;
+    if (total <= limit) {
+        return 0;
     }
-    if (chosen != iInvalidPos) {
-        iRecentUrl *url = at_Array(&d->recent, chosen);
-        const size_t before = memorySize_RecentUrl(url);
-        iReleasePtr(&url->cachedDoc);
-        delta = before - memorySize_RecentUrl(url);
+    iArray heap;
+    init_Array(&heap, sizeof(iCacheCandidate));
+    collectCandidates_CacheRegistry_(reg, isMemory, &heap);
+    uint32_t cacheId;
+    while (total > limit && popCandidate_CacheCandidates_(&heap, &cacheId)) {
+        iHistory *owner = owner_CacheRegistry_(reg, cacheId);
+        if (owner) {
+            const size_t delta = pruneCached_History_(owner, cacheId, isMemory);
+            total -= iMin(total, delta);
+            freed += delta;
+        }
     }
+    deinit_Array(&heap);
+    return freed;
+}
+
+size_t pruneCache_History(size_t limit) {
+    return prune_History_(limit, iFalse);
+}
+
+size_t pruneMemory_History(size_t limit) {
+    return prune_History_(limit, iTrue);
+}
+
+void loadContent_History(iHistory *d) {
+    lock_Mutex(d->mtx);
+    updateCompression_History_(d);
     unlock_Mutex(d->mtx);
-    return delta;
+}
+
+iMemInfo totalMemoryUsage_History(void) {
+    iCacheRegistry *reg = cache_History_();
+    iMemInfo        mem;
+    lock_Mutex(reg->mtx);
+    mem.cacheSize  = reg->cacheSize;
+    mem.memorySize = reg->memorySize;
+    unlock_Mutex(reg->mtx);
+    return mem;
 }
 
 void invalidateTheme_History(iHistory *d) {
@@ -584,53 +1282,227 @@ void invalidateTheme_History(iHistory *d) {
     unlock_Mutex(d->mtx);
 }
 
-const iStringArray *searchContents_History(const iHistory *d, const iRegExp *pattern) {
-    iStringArray *urls = iClob(new_StringArray());
-    lock_Mutex(d->mtx);
-    iStringSet inserted;
-    init_StringSet(&inserted);
-    iReverseConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        const iGmResponse *resp = url->cachedResponse;
-        if (resp && category_GmStatusCode(resp->statusCode) == categorySuccess_GmStatusCode) {
-            if (indexOfCStrSc_String(&resp->meta, "text/", &iCaseInsensitive) == iInvalidPos) {
-                continue;
+iDeclareType(ContentScore)
+
+struct Impl_ContentScore {
+    uint32_t cacheId;
+    uint32_t terms; /* bit mask of matched terms */
+    float    score;
+};
+
+static int cmp_ContentScore_(const void *a, const void *b) {
+    return iCmp(((const iContentScore *) a)->cacheId, ((const iContentScore *) b)->cacheId);
+}
+
+static int cmpRelevance_ContentScore_(const void *a, const void *b) {
+    const float s1 = ((const iContentScore *) a)->score, s2 = ((const iContentScore *) b)->score;
+    return s1 < s2 ? 1 : s1 > s2 ? -1 : 0;
+}
+
+static iBool isSearched_History_(const iPtrArray *histories, const iHistory *d) {
+    iConstForEach(PtrArray, i, histories) {
+        if (i.ptr == d) return iTrue;
+    }
+    return iFalse;
+}
+
+static void indexPending_History_(const iPtrArray *histories) {
+    /* Compressed and stored bodies are indexed when first searched. The bodies are read
+       and decompressed without holding any locks. */
+    iCacheRegistry *reg = cache_History_();
+    iArray pending;
+    init_Array(&pending, sizeof(iCacheCandidate));
+    lock_Mutex(reg->mtx);
+    iConstForEach(Hash, i, &reg->items) {
+        const iCacheItem *item = (const iCacheItem *) i.value;
+        if (!item->isIndexed && isSearched_History_(histories, item->history)) {
+            pushBack_Array(&pending, &(iCacheCandidate){ 0, item->node.key });
+        }
+    }
+    unlock_Mutex(reg->mtx);
+    iConstForEach(Array, i, &pending) {
+        const uint32_t cacheId = ((const iCacheCandidate *) i.value)->cacheId;
+        iHistory *owner = owner_CacheRegistry_(reg, cacheId);
+        if (!owner) continue;
+        iBodySource src;
+        iBool       hasBody = iFalse;
+        lock_Mutex(owner->mtx);
+        const size_t index = findCached_History_(owner, cacheId);
+        if (index != iInvalidPos) {
+            const iRecentUrl *url = constAt_Array(&owner->recent, index);
+            if (url->cachedResponse && isIndexable_GmResponse_(url->cachedResponse)) {
+                hasBody = init_BodySource_(&src, url);
             }
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (matchRange_RegExp(pattern, range_Block(&resp->body), &m)) {
-                iString entry;
-                init_String(&entry);
-                iRangei cap = m.range;
-                const int prefix = iMin(10, cap.start);
-                cap.start   = cap.start - prefix;
-                cap.end     = iMin(cap.end + 30, (int) size_Block(&resp->body));
-                const size_t maxLen = 60;
-                if (size_Range(&cap) > maxLen) {
-                    cap.end = cap.start + maxLen;
-                }
-                iString content;
-                initRange_String(&content, (iRangecc){ m.subject + cap.start, m.subject + cap.end });
-                /* This needs cleaning up; highlight the matched word. */
-                replace_Block(&content.chars, '\n', ' ');
-                replace_Block(&content.chars, '\r', ' ');
-                if (prefix + size_Range(&m.range) < size_String(&content)) {
-                    insertData_Block(&content.chars, prefix + size_Range(&m.range), uiText_ColorEscape, 2);
-                }
-                insertData_Block(&content.chars, prefix, uiTextStrong_ColorEscape, 2);
-                format_String(
-                    &entry, "match len:%zu str:%s", size_String(&content), cstr_String(&content));
-                deinit_String(&content);
-                appendFormat_String(&entry, " url:%s", cstr_String(&url->url));
-                if (!contains_StringSet(&inserted, &url->url)) {
-                    pushFront_StringArray(urls, &entry);
-                    insert_StringSet(&inserted, &url->url);
+        }
+        unlock_Mutex(owner->mtx);
+        iBlock *text = NULL;
+        if (hasBody) {
+            iBlock *body = read_BodySource_(&src);
+            if (body) {
+                text = lower_History_(range_Block(body));
+                delete_Block(body);
+            }
+            deinit_BodySource_(&src);
+        }
+        lock_Mutex(reg->mtx);
+        iCacheItem *item = (iCacheItem *) value_Hash(&reg->items, cacheId);
+        if (item && !item->isIndexed) {
+            index_CacheRegistry_(reg, item, text);
+        }
+        unlock_Mutex(reg->mtx);
+        delete_Block(text);
+    }
+    deinit_Array(&pending);
+}
+
+static void makeSnippet_ContentMatch_(iContentMatch *d, const iBlock *body, iRangecc term) {
+    /* Finds the first word that begins with the (lower case) term and takes some text
+       around it. Case folding may change the length of the text, so the match is checked
+       against the original text one word at a time. */
+    const char  *src      = constData_Block(body);
+    const size_t size     = size_Block(body);
+    size_t       found    = iInvalidPos;
+    size_t       matchLen = 0;
+    for (iRangecc word = iNullRange; nextWord_History_(range_Block(body), &word); ) {
+        const char *matchEnd = matchLower_History_(word.start, word.end, term);
+        if (matchEnd) {
+            found    = word.start - src;
+            matchLen = matchEnd - word.start;
+            break;
+        }
+    }
+    if (found == iInvalidPos) {
+        return;
+    }
+    size_t      start = found > 10 ? found - 10 : 0;
+    size_t      end   = iMin(start + 60, size);
+    /* Don't split UTF-8 sequences. */
+    while (start > 0 && (src[start] & 0xc0) == 0x80) start--;
+    while (end < size && (src[end] & 0xc0) == 0x80) end++;
+    setRange_String(&d->snippet, (iRangecc){ src + start, src + end });
+    replace_Block(&d->snippet.chars, '\n', ' ');
+    replace_Block(&d->snippet.chars, '\r', ' ');
+    replace_Block(&d->snippet.chars, '\t', ' ');
+    d->mark.start = found - start;
+    d->mark.end   = iMin(d->mark.start + (int) matchLen, (int) (end - start));
+}
+
+void init_ContentMatch(iContentMatch *d) {
+    init_String(&d->url);
+    init_String(&d->snippet);
+    d->mark      = (iRangei){ 0, 0 };
+    d->relevance = 0.0f;
+}
+
+void deinit_ContentMatch(iContentMatch *d) {
+    deinit_String(&d->snippet);
+    deinit_String(&d->url);
+}
+
+iDefineTypeConstruction(ContentMatch)
+
+iPtrArray *searchContent_History(const iPtrArray *histories, const iString *query,
+                                 size_t maxResults) {
+    iPtrArray *matches = new_PtrArray();
+    iBlock *lowerQuery = lower_History_(range_String(query));
+    iArray terms;
+    init_Array(&terms, sizeof(iRangecc));
+    for (iRangecc word = iNullRange;
+         nextWord_History_(range_Block(lowerQuery), &word) && size_Array(&terms) < 31; ) {
+        pushBack_Array(&terms, &word);
+    }
+    if (isEmpty_Array(&terms) || maxResults == 0) {
+        deinit_Array(&terms);
+        delete_Block(lowerQuery);
+        return matches;
+    }
+    indexPending_History_(histories);
+    /* Score the responses that contain all the terms. Exact word matches are worth more
+       than prefix matches, and rare words are worth more than common ones. */
+    iCacheRegistry *reg = cache_History_();
+    iSortedArray scores;
+    init_SortedArray(&scores, sizeof(iContentScore), cmp_ContentScore_);
+    lock_Mutex(reg->mtx);
+    const float numItems = (float) size_Hash(&reg->items);
+    iConstForEach(Array, t, &terms) {
+        const iRangecc *term = t.value;
+        const uint32_t  bit  = 1u << index_ArrayConstIterator(&t);
+        size_t pos;
+        findWord_CacheRegistry_(reg, *term, &pos);
+        for (; pos < size_SortedArray(&reg->words); pos++) {
+            const iContentWord *cw = *(const iContentWord **) constAt_SortedArray(&reg->words, pos);
+            if (size_String(&cw->text) < size_Range(term) ||
+                memcmp(cstr_String(&cw->text), term->start, size_Range(term))) {
+                break;
+            }
+            const float weight = (size_String(&cw->text) == size_Range(term) ? 2.0f : 1.0f) *
+                                 logf(1.0f + numItems / size_Array(&cw->postings));
+            iConstForEach(Array, p, &cw->postings) {
+                const iContentPosting *post = p.value;
+                iContentScore key = { post->cacheId, 0, 0.0f };
+                size_t spos;
+                if (!locate_SortedArray(&scores, &key, &spos)) {
+                    insert_SortedArray(&scores, &key);
+                    locate_SortedArray(&scores, &key, &spos);
                 }
-                deinit_String(&entry);
+                iContentScore *sc = at_SortedArray(&scores, spos);
+                sc->terms |= bit;
+                sc->score += weight * (1.0f + logf((float) post->count));
             }
         }
     }
-    deinit_StringSet(&inserted);
-    unlock_Mutex(d->mtx);
-    return urls;
+    unlock_Mutex(reg->mtx);
+    const uint32_t allTerms = (1u << size_Array(&terms)) - 1;
+    iArray ranked;
+    init_Array(&ranked, sizeof(iContentScore));
+    for (size_t i = 0; i < size_SortedArray(&scores); i++) {
+        const iContentScore *sc = constAt_SortedArray(&scores, i);
+        if (sc->terms == allTerms) {
+            pushBack_Array(&ranked, sc);
+        }
+    }
+    deinit_SortedArray(&scores);
+    sort_Array(&ranked, cmpRelevance_ContentScore_);
+    /* Make the results for the best matches. The same URL may be cached in many places. */
+    iStringSet urls;
+    init_StringSet(&urls);
+    iConstForEach(Array, r, &ranked) {
+        if (size_PtrArray(matches) >= maxResults) break;
+        const iContentScore *sc = r.value;
+        iHistory *owner = owner_CacheRegistry_(reg, sc->cacheId);
+        if (!owner || !isSearched_History_(histories, owner)) continue;
+        iString     urlStr;
+        iBodySource src;
+        iBool       hasBody = iFalse;
+        init_String(&urlStr);
+        lock_Mutex(owner->mtx);
+        const size_t index = findCached_History_(owner, sc->cacheId);
+        if (index != iInvalidPos) {
+            const iRecentUrl *url = constAt_Array(&owner->recent, index);
+            if (!contains_StringSet(&urls, &url->url)) {
+                set_String(&urlStr, &url->url);
+                hasBody = init_BodySource_(&src, url);
+            }
+        }
+        unlock_Mutex(owner->mtx);
+        if (hasBody) {
+            iBlock *body = read_BodySource_(&src);
+            if (body) {
+                iContentMatch *match = new_ContentMatch();
+                set_String(&match->url, &urlStr);
+                match->relevance = sc->score;
+                makeSnippet_ContentMatch_(match, body, constValue_Array(&terms, 0, iRangecc));
+                pushBack_PtrArray(matches, match);
+                insert_StringSet(&urls, &urlStr);
+                delete_Block(body);
+            }
+            deinit_BodySource_(&src);
+        }
+        deinit_String(&urlStr);
+    }
+    deinit_StringSet(&urls);
+    deinit_Array(&ranked);
+    deinit_Array(&terms);
+    delete_Block(lowerQuery);
+    return matches;
 }
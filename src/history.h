@@ -40,9 +40,23 @@ struct Impl_RecentUrl {
     iGmResponse *cachedResponse; /* kept in memory for quicker back navigation */
     iGmDocument *cachedDoc;      /* cached copy of the presentation: layout and media (not serialized) */
     iBlock       setIdentity;    /* fingerprint of identity that was pinned*/
+    uint32_t     cacheId;        /* registered in the global cache (not serialized) */
+    uint64_t     contentId;      /* hash of the body saved in the content store */
+    uint32_t     pendingSize;    /* size of the saved body that hasn't been loaded yet */
+    iBool        isCompressed;   /* cachedResponse body is zlib-compressed while not current */
     uint16_t     flags;
 };
 
+iDeclareType(ContentMatch)
+iDeclareTypeConstruction(ContentMatch)
+
+struct Impl_ContentMatch {
+    iString url;
+    iString snippet;   /* text around the first matching word */
+    iRangei mark;      /* position of the match in the snippet */
+    float   relevance;
+};
+
 iDeclareType(MemInfo)
 
 struct Impl_MemInfo {
@@ -77,15 +91,13 @@ iRecentUrl *mostRecentUrl_History       (iHistory *);
 //iRecentUrl *findUrl_History             (iHistory *, const iString *url, int timeDir);
 
 void        clearCache_History                  (iHistory *);
-size_t      pruneLeastImportant_History         (iHistory *);
-size_t      pruneLeastImportantMemory_History   (iHistory *);
 void        invalidateTheme_History             (iHistory *); /* theme has changed, cached contents need updating */
 void        invalidateCachedLayout_History      (iHistory *);
+void        loadContent_History                 (iHistory *); /* current item is loaded, others compressed */
 
 iBool       atNewest_History            (const iHistory *);
 iBool       atOldest_History            (const iHistory *);
 
-const iStringArray *   searchContents_History   (const iHistory *, const iRegExp *pattern); /* chronologically ascending */
 
 const iString *
             url_History                 (const iHistory *, size_t pos);
@@ -95,8 +107,16 @@ const iRecentUrl *
             constMostRecentUrl_History  (const iHistory *);
 const iGmResponse *
             cachedResponse_History      (const iHistory *);
-size_t      cacheSize_History           (const iHistory *);
-size_t      memorySize_History          (const iHistory *);
 
 iString *   debugInfo_History           (const iHistory *);
 iMemInfo    memoryUsage_History         (const iHistory *);
+
+/* Global cache of all History instances. Pruning evicts the largest and oldest items
+   until the total is within the limit (bytes), and returns the number of bytes freed. */
+iMemInfo    totalMemoryUsage_History    (void);
+void        setContentDir_History       (const char *dir);
+iPtrArray * searchContent_History       (const iPtrArray *histories, const iString *query,
+                                         size_t maxResults); /* iContentMatch, caller deletes */
+void        purgeContent_History        (void); /* remove content not referenced by the latest save */
+size_t      pruneCache_History          (size_t limit);
+size_t      pruneMemory_History         (size_t limit);
@@ -22,6 +22,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "lookup.h"
 
+#include <ctype.h>
+#include <string.h>
+
 iDefineTypeConstruction(LookupResult)
 
 void init_LookupResult(iLookupResult *d) {
@@ -50,3 +53,140 @@ iLookupResult *copy_LookupResult(const iLookupResult *d) {
     set_String(&copy->meta, &d->meta);
     return copy;
 }
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDefineTypeConstructionArgs(LookupPattern, (const iString *term), term)
+
+void init_LookupPattern(iLookupPattern *d, const iString *term) {
+    init_String(&d->folded);
+    init_Array(&d->words, sizeof(iRangecc));
+    /* Folded one character at a time, like the text when matching. */
+    iConstForEach(String, i, term) {
+        appendChar_String(&d->folded, lower_Char(i.value));
+    }
+    iRangecc word = iNullRange;
+    while (nextSplit_Rangecc(range_String(&d->folded), " ", &word)) {
+        if (!isEmpty_Range(&word)) {
+            pushBack_Array(&d->words, &word);
+        }
+    }
+}
+
+void deinit_LookupPattern(iLookupPattern *d) {
+    deinit_Array(&d->words);
+    deinit_String(&d->folded);
+}
+
+static const char *matchFolded_(const char *text, const char *end, iRangecc folded) {
+    /* Returns the end of the matching text, or NULL. The text is lowercased one character
+       at a time, so its length may differ from the folded word. */
+    const char *f = folded.start;
+    while (f < folded.end) {
+        if (text >= end) {
+            return NULL;
+        }
+        if ((uint8_t) *text < 0x80) {
+            if (tolower((uint8_t) *text) != (uint8_t) *f) {
+                return NULL;
+            }
+            text++;
+            f++;
+            continue;
+        }
+        iChar     ch;
+        const int len = decodeBytes_MultibyteChar(text, end, &ch);
+        if (len <= 0) {
+            return NULL;
+        }
+        iMultibyteChar mb;
+        init_MultibyteChar(&mb, lower_Char(ch));
+        const size_t n = strlen(mb.bytes);
+        if ((size_t) (folded.end - f) < n || memcmp(f, mb.bytes, n)) {
+            return NULL;
+        }
+        text += len;
+        f    += n;
+    }
+    return text;
+}
+
+static const char *findFolded_(const char *pos, const char *end, iRangecc word,
+                               const char **matchEnd) {
+    if ((uint8_t) word.start[0] >= 0x80) {
+        /* Every character is a candidate. */
+        for (; pos < end; pos++) {
+            if (((uint8_t) *pos & 0xc0) != 0x80 && (*matchEnd = matchFolded_(pos, end, word))) {
+                return pos;
+            }
+        }
+        return NULL;
+    }
+    /* The candidates for an ASCII first letter are located with memchr(), which is
+       vectorized in most C libraries. */
+    const char lower = word.start[0];
+    const char upper = (char) toupper((uint8_t) lower);
+    while (pos < end) {
+        const char *cand = memchr(pos, lower, end - pos);
+        if (upper != lower) {
+            const char *candUpper = memchr(pos, upper, (cand ? cand : end) - pos);
+            if (candUpper) {
+                cand = candUpper;
+            }
+        }
+        if (!cand) {
+            break;
+        }
+        if ((*matchEnd = matchFolded_(cand, end, word)) != NULL) {
+            return cand;
+        }
+        pos = cand + 1;
+    }
+    return NULL;
+}
+
+static int boundaryBonus_(iRangecc text, const char *pos) {
+    if (pos == text.start) {
+        return 3;
+    }
+    const uint8_t prev = (uint8_t) pos[-1];
+    if (prev < 0x80 && !isalnum(prev)) {
+        return 2; /* beginning of a word, path segment, or domain label */
+    }
+    if (islower(prev) && isupper((uint8_t) *pos)) {
+        return 1; /* camelCase */
+    }
+    return 0;
+}
+
+float score_LookupPattern(const iLookupPattern *d, iRangecc text) {
+    /* Like fzf, word boundaries are rewarded and gaps between the words are penalized.
+       Every occurrence of the word sequence adds to the score, and matches near the
+       beginning of the text are scored higher. */
+    float score = 0.0f;
+    if (isEmpty_Array(&d->words) || !text.start) {
+        return score;
+    }
+    const char *pos = text.start;
+    for (;;) {
+        const char *start = NULL;
+        float       seq   = 0.0f;
+        iConstForEach(Array, i, &d->words) {
+            const iRangecc *word  = i.value;
+            const char *    matchEnd;
+            const char *    found = findFolded_(pos, text.end, *word, &matchEnd);
+            if (!found) {
+                return score;
+            }
+            if (!start) {
+                start = found;
+            }
+            else {
+                seq -= iMin(found - pos, 16) * 0.125f;
+            }
+            seq += size_Range(word) + boundaryBonus_(text, found);
+            pos = matchEnd;
+        }
+        score += iMax(seq, 1.0f) / (float) (start - text.start + 1);
+    }
+}
@@ -22,6 +22,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #pragma once
 
+#include <the_Foundation/array.h>
 #include <the_Foundation/string.h>
 #include <the_Foundation/time.h>
 
@@ -35,6 +36,7 @@ enum iLookupResultType {
     history_LookupResultType, /* visited URLs */
     content_LookupResultType, /* one of the pages in history, including current page */
     identity_LookupResultType,
+    max_LookupResultType
 };
 
 struct Impl_LookupResult {
@@ -50,3 +52,17 @@ struct Impl_LookupResult {
 iDeclareTypeConstruction(LookupResult)
 
 iLookupResult *     copy_LookupResult   (const iLookupResult *);
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(LookupPattern)
+iDeclareTypeConstructionArgs(LookupPattern, const iString *term)
+
+/* Case-insensitive matcher for space-separated words that must appear in the given order,
+   like the regular expression "word1.*word2". */
+struct Impl_LookupPattern {
+    iString folded; /* lowercase term */
+    iArray  words;  /* iRangecc in `folded` */
+};
+
+float   score_LookupPattern     (const iLookupPattern *, iRangecc text);
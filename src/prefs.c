@@ -82,6 +82,8 @@ void init_Prefs(iPrefs *d) {
     d->detachedPrefs     = iTrue;
     d->pinSplit          = 1;
     d->feedInterval      = fourHours_FeedInterval;
+    d->feedConcurrency   = 8;
+    d->feedHostConcurrency = 2;
     d->time24h           = iTrue;
     d->returnKey         = default_ReturnKeyBehavior;
     d->retainTabs        = iTrue;
@@ -217,6 +217,8 @@ struct Impl_Prefs {
     /* Behavior */
     int              pinSplit; /* 0: no pinning, 1: left doc, 2: right doc */
     enum iFeedInterval feedInterval;
+    int              feedConcurrency; /* simultaneous feed requests */
+    int              feedHostConcurrency; /* simultaneous feed requests to a single server */
     int              returnKey;
     int              smoothScrollSpeed[max_ScrollType];
     enum iCollapse   collapsePre;
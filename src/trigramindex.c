@@ -0,0 +1,177 @@
+/* Copyright 2026 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include "trigramindex.h"
+
+#include <the_Foundation/array.h>
+
+iDeclareType(TrigramPostings)
+
+struct Impl_TrigramPostings {
+    iHashNode node; /* key is the lowercase trigram */
+    iIntSet   ids;
+};
+
+iDefineTypeConstruction(TrigramIndex)
+
+void init_TrigramIndex(iTrigramIndex *d) {
+    init_Hash(&d->postings);
+}
+
+void deinit_TrigramIndex(iTrigramIndex *d) {
+    clear_TrigramIndex(d);
+    deinit_Hash(&d->postings);
+}
+
+void clear_TrigramIndex(iTrigramIndex *d) {
+    iForEach(Hash, i, &d->postings) {
+        iTrigramPostings *post = (iTrigramPostings *) i.value;
+        remove_HashIterator(&i);
+        deinit_IntSet(&post->ids);
+        free(post);
+    }
+}
+
+static void fold_TrigramIndex_(iRangecc text, iBlock *folded_out) {
+    /* Folded one character at a time, like search terms in LookupPattern, so that the
+       trigrams of a term are found regardless of case. Invalid bytes are kept as is. */
+    clear_Block(folded_out);
+    for (const char *pos = text.start; pos < text.end; ) {
+        iChar     ch;
+        const int len = decodeBytes_MultibyteChar(pos, text.end, &ch);
+        if (len <= 0) {
+            pushBack_Block(folded_out, *pos++);
+            continue;
+        }
+        iMultibyteChar mb;
+        init_MultibyteChar(&mb, lower_Char(ch));
+        appendCStr_Block(folded_out, mb.bytes);
+        pos += len;
+    }
+}
+
+static iBool nextTrigram_(iRangecc folded, const char **pos, uint32_t *key_out) {
+    /* Trigrams with spaces are skipped because search terms are split at spaces. */
+    while (*pos && folded.end - *pos >= 3) {
+        const char *p = (*pos)++;
+        if (p[0] == ' ' || p[1] == ' ' || p[2] == ' ') {
+            continue;
+        }
+        *key_out = ((uint32_t) (uint8_t) p[0] << 16) |
+                   ((uint32_t) (uint8_t) p[1] << 8) |
+                   (uint32_t) (uint8_t) p[2];
+        return iTrue;
+    }
+    return iFalse;
+}
+
+void add_TrigramIndex(iTrigramIndex *d, uint32_t id, iRangecc text) {
+    iBlock folded;
+    init_Block(&folded, 0);
+    fold_TrigramIndex_(text, &folded);
+    text = range_Block(&folded);
+    const char *pos = text.start;
+    uint32_t    key;
+    while (nextTrigram_(text, &pos, &key)) {
+        iTrigramPostings *post = (iTrigramPostings *) value_Hash(&d->postings, key);
+        if (!post) {
+            post = iMalloc(TrigramPostings);
+            post->node.key = key;
+            init_IntSet(&post->ids);
+            insert_Hash(&d->postings, &post->node);
+        }
+        insert_IntSet(&post->ids, id);
+    }
+    deinit_Block(&folded);
+}
+
+void remove_TrigramIndex(iTrigramIndex *d, uint32_t id, iRangecc text) {
+    iBlock folded;
+    init_Block(&folded, 0);
+    fold_TrigramIndex_(text, &folded);
+    text = range_Block(&folded);
+    const char *pos = text.start;
+    uint32_t    key;
+    while (nextTrigram_(text, &pos, &key)) {
+        iTrigramPostings *post = (iTrigramPostings *) value_Hash(&d->postings, key);
+        if (post) {
+            remove_IntSet(&post->ids, id);
+            if (isEmpty_IntSet(&post->ids)) {
+                remove_Hash(&d->postings, key);
+                deinit_IntSet(&post->ids);
+                free(post);
+            }
+        }
+    }
+    deinit_Block(&folded);
+}
+
+static int cmpSize_TrigramPostingsPtr_(const void *a, const void *b) {
+    const iTrigramPostings *x = *(const iTrigramPostings **) a;
+    const iTrigramPostings *y = *(const iTrigramPostings **) b;
+    return iCmp(size_IntSet(&x->ids), size_IntSet(&y->ids));
+}
+
+iBool query_TrigramIndex(const iTrigramIndex *d, const iString *term, iIntSet *ids_out) {
+    clear_IntSet(ids_out);
+    iArray posts;
+    init_Array(&posts, sizeof(const iTrigramPostings *));
+    iBlock folded;
+    init_Block(&folded, 0);
+    fold_TrigramIndex_(range_String(term), &folded);
+    iBool    haveTrigrams = iFalse;
+    iRangecc word         = iNullRange;
+    while (nextSplit_Rangecc(range_Block(&folded), " ", &word)) {
+        const char *pos = word.start;
+        uint32_t    key;
+        while (nextTrigram_(word, &pos, &key)) {
+            const iTrigramPostings *post = (const iTrigramPostings *) value_Hash(&d->postings, key);
+            haveTrigrams = iTrue;
+            if (!post) {
+                /* Nothing has this trigram. */
+                deinit_Array(&posts);
+                deinit_Block(&folded);
+                return iTrue;
+            }
+            pushBack_Array(&posts, &post);
+        }
+    }
+    if (haveTrigrams) {
+        /* Intersect starting from the shortest list. */
+        sort_Array(&posts, cmpSize_TrigramPostingsPtr_);
+        const iTrigramPostings *shortest = *(const iTrigramPostings **) at_Array(&posts, 0);
+        iConstForEach(IntSet, i, &shortest->ids) {
+            iBool inAll = iTrue;
+            for (size_t j = 1; j < size_Array(&posts) && inAll; j++) {
+                const iTrigramPostings *post = *(const iTrigramPostings **) at_Array(&posts, j);
+                inAll = contains_IntSet(&post->ids, *i.value);
+            }
+            if (inAll) {
+                insert_IntSet(ids_out, *i.value);
+            }
+        }
+    }
+    deinit_Array(&posts);
+    deinit_Block(&folded);
+    return haveTrigrams;
+}
@@ -0,0 +1,53 @@
+/* Copyright 2026 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#pragma once
+
+#include <the_Foundation/hash.h>
+#include <the_Foundation/intset.h>
+#include <the_Foundation/string.h>
+
+/* Index of three-byte sequences of case-folded UTF-8 text for narrowing down the items
+   that may contain the words of a search term. Items are identified with numbers chosen
+   by the owner of the index. */
+
+iDeclareType(TrigramIndex)
+iDeclareTypeConstruction(TrigramIndex)
+
+struct Impl_TrigramIndex {
+    iHash postings; /* TrigramPostings by trigram */
+};
+
+void    clear_TrigramIndex  (iTrigramIndex *);
+void    add_TrigramIndex    (iTrigramIndex *, uint32_t id, iRangecc text);
+void    remove_TrigramIndex (iTrigramIndex *, uint32_t id, iRangecc text); /* remove all of an item's texts together */
+
+/**
+ * Finds the items that contain every trigram of the words of @a term. Words shorter
+ * than three bytes do not narrow down the search.
+ *
+ * @param ids_out  Matching item IDs.
+ *
+ * @returns @c iFalse if the term has no trigrams, so every item is a potential match.
+ */
+iBool   query_TrigramIndex  (const iTrigramIndex *, const iString *term, iIntSet *ids_out);
@@ -241,6 +241,8 @@ enum iDocumentWidgetFlag {
                                                             tabs to finished their requests */
     pendingRedirect_DocumentWidgetFlag       = iBit(29), /* a redirect has been issued */
     goBackOnStop_DocumentWidgetFlag          = iBit(30),
+    dormant_DocumentWidgetFlag               = iBit(31), /* restored from saved state; document
+                                                            is created when first needed */
 };
 
 enum iDocumentLinkOrdinalMode {
@@ -289,6 +291,8 @@ struct Impl_DocumentWidget {
     /* Document: */
     iPersistentDocumentState mod;
     iString *      titleUser;
+    iString *      dormantTitle; /* document title and site icon shown while dormant */
+    iChar          dormantIcon;
     enum iGmStatusCode sourceStatus;
     iString        sourceHeader;
     iString        sourceMime;
@@ -682,6 +686,17 @@ static void animateMedia_DocumentWidget_(iDocumentWidget *d) {
     }
 }
 
+static const iString *documentTitle_DocumentWidget_(const iDocumentWidget *d) {
+    /* A dormant tab has no document yet, so the title saved with the tab is used. */
+    return d->flags & dormant_DocumentWidgetFlag ? d->dormantTitle
+                                                 : title_GmDocument(d->view->doc);
+}
+
+static iChar siteIcon_DocumentWidget_(const iDocumentWidget *d) {
+    return d->flags & dormant_DocumentWidgetFlag ? d->dormantIcon
+                                                 : siteIcon_GmDocument(d->view->doc);
+}
+
 static void updateWindowTitle_DocumentWidget_(const iDocumentWidget *d) {
     iLabelWidget *tabButton = tabPageButton_Widget(findChild_Widget(root_Widget(constAs_Widget(d)),
                                                                     "doctabs"), d);
@@ -694,8 +709,8 @@ static void updateWindowTitle_DocumentWidget_(const iDocumentWidget *d) {
         return;
     }
     iStringArray *title = iClob(new_StringArray());
-    if (!isEmpty_String(title_GmDocument(d->view->doc))) {
-        pushBack_StringArray(title, title_GmDocument(d->view->doc));
+    if (!isEmpty_String(documentTitle_DocumentWidget_(d))) {
+        pushBack_StringArray(title, documentTitle_DocumentWidget_(d));
     }
     if (!isEmpty_String(d->titleUser)) {
         pushBack_StringArray(title, d->titleUser);
@@ -740,7 +755,7 @@ static void updateWindowTitle_DocumentWidget_(const iDocumentWidget *d) {
             setTitle_Window(as_Window(get_MainWindow()), text);
             setWindow = iFalse;
         }
-        const iChar siteIcon = siteIcon_GmDocument(d->view->doc);
+        const iChar siteIcon = siteIcon_DocumentWidget_(d);
         /* Remove a redundant icon. */ {
             iStringConstIterator iter;
             init_StringConstIterator(&iter, text);
@@ -1608,6 +1623,7 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d,
 }
 
 static iBool fetch_DocumentWidget_(iDocumentWidget *d) {
+    d->flags &= ~dormant_DocumentWidgetFlag;
     /* We may be instructed to wait before fetching to avoid congestion. */
     if (d->flags & waitForIdle_DocumentWidgetFlag) {
         /* Check all documents in the window. */
@@ -1824,6 +1840,7 @@ static void updateFromCachedResponse_DocumentWidget_(iDocumentWidget *d, float n
 }
 
 static iBool updateFromHistory_DocumentWidget_(iDocumentWidget *d, iBool useCachedDoc) {
+    loadContent_History(d->mod.history);
     const iRecentUrl *recent = constMostRecentUrl_History(d->mod.history);
     setIdentity_DocumentWidget(d, recent ? &recent->setIdentity : NULL);
     if (recent && recent->cachedResponse && equalCase_String(&recent->url, d->mod.url)) {
@@ -2890,6 +2907,7 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
     else if (equal_Command(cmd, "tabs.changed")) {
         setLinkNumberMode_DocumentWidget_(d, iFalse);
         if (cmp_String(id_Widget(w), suffixPtr_Command(cmd, "id")) == 0) {
+            wakeUp_DocumentWidget(d);
             /* Set palette for our document. */
             updateTheme_DocumentWidget_(d);
             updateTrust_DocumentWidget_(d, NULL);
@@ -5219,6 +5237,8 @@ void init_DocumentWidget(iDocumentWidget *d) {
     d->certSubject         = new_String();
     d->state               = blank_RequestState;
     d->titleUser           = new_String();
+    d->dormantTitle        = new_String();
+    d->dormantIcon         = 0;
     d->request             = NULL;
     d->requestLinkId       = 0;
     d->media               = new_ObjectList();
@@ -5305,6 +5325,7 @@ void deinit_DocumentWidget(iDocumentWidget *d) {
     delete_Block(d->certFingerprint);
     delete_String(d->certSubject);
     delete_String(d->titleUser);
+    delete_String(d->dormantTitle);
     deinit_PersistentDocumentState(&d->mod);
 }
 
@@ -5375,16 +5396,16 @@ iBool isIdentityPinned_DocumentWidget(const iDocumentWidget *d) {
 }
 
 const iString *feedTitle_DocumentWidget(const iDocumentWidget *d) {
-    if (!isEmpty_String(title_GmDocument(d->view->doc))) {
-        return title_GmDocument(d->view->doc);
+    if (!isEmpty_String(documentTitle_DocumentWidget_(d))) {
+        return documentTitle_DocumentWidget_(d);
     }
     return bookmarkTitle_DocumentWidget(d);
 }
 
 const iString *bookmarkTitle_DocumentWidget(const iDocumentWidget *d) {
     iStringArray *title = iClob(new_StringArray());
-    if (!isEmpty_String(title_GmDocument(d->view->doc))) {
-        pushBack_StringArray(title, title_GmDocument(d->view->doc));
+    if (!isEmpty_String(documentTitle_DocumentWidget_(d))) {
+        pushBack_StringArray(title, documentTitle_DocumentWidget_(d));
     }
     if (!isEmpty_String(d->titleUser)) {
         pushBack_StringArray(title, d->titleUser);
@@ -5404,24 +5425,55 @@ const iString *bookmarkTitle_DocumentWidget(const iDocumentWidget *d) {
 
 void serializeState_DocumentWidget(const iDocumentWidget *d, iStream *outs, iBool withContent) {
     serializeWithContent_PersistentDocumentState_(&d->mod, outs, withContent);
+    /* Shown while the tab is dormant after the next launch. */
+    serialize_String(documentTitle_DocumentWidget_(d), outs);
+    writeU32_Stream(outs, siteIcon_DocumentWidget_(d));
+}
+
+static void deserializeTitle_DocumentWidget_(iString *title, iChar *icon, iStream *ins) {
+    if (version_Stream(ins) >= dormantTabTitle_FileVersion) {
+        deserialize_String(title, ins);
+        *icon = readU32_Stream(ins);
+    }
 }
 
 void deserializeState_DocumentWidget(iDocumentWidget *d, iStream *ins) {
     if (d) {
         deserialize_PersistentDocumentState(&d->mod, ins);
+        deserializeTitle_DocumentWidget_(d->dormantTitle, &d->dormantIcon, ins);
         parseUser_DocumentWidget_(d);
-        updateFromHistory_DocumentWidget_(d, iTrue);
+        /* Importing and laying out the cached content is postponed until the tab is
+           shown, or the app has some idle time. */
+        d->flags |= dormant_DocumentWidgetFlag;
+        updateWindowTitle_DocumentWidget_(d);
     }
     else {
         /* Read and throw away the data. */
         iPersistentDocumentState *dummy = new_PersistentDocumentState();
         deserialize_PersistentDocumentState(dummy, ins);
         delete_PersistentDocumentState(dummy);
+        iString title;
+        iChar   icon;
+        init_String(&title);
+        deserializeTitle_DocumentWidget_(&title, &icon, ins);
+        deinit_String(&title);
+    }
+}
+
+iBool isDormant_DocumentWidget(const iDocumentWidget *d) {
+    return (d->flags & dormant_DocumentWidgetFlag) != 0;
+}
+
+void wakeUp_DocumentWidget(iDocumentWidget *d) {
+    if (d->flags & dormant_DocumentWidgetFlag) {
+        d->flags &= ~dormant_DocumentWidgetFlag;
+        updateFromHistory_DocumentWidget_(d, iTrue);
     }
 }
 
 void setUrlFlags_DocumentWidget(iDocumentWidget *d, const iString *url, int setUrlFlags,
                                 const iBlock *setIdent) {
+    d->flags &= ~dormant_DocumentWidgetFlag; /* replaced with new contents */
     const iBool allowCache     = (setUrlFlags & useCachedContentIfAvailable_DocumentWidgetSetUrlFlag) != 0;
     const iBool allowCachedDoc = (setUrlFlags & disallowCachedDocument_DocumentWidgetSetUrlFlag) == 0;
     iChangeFlags(d->flags, preventInlining_DocumentWidgetFlag,
@@ -40,7 +40,9 @@ iDocumentWidget *   duplicate_DocumentWidget        (const iDocumentWidget *);
 void                cancelAllRequests_DocumentWidget(iDocumentWidget *);
 
 void    serializeState_DocumentWidget   (const iDocumentWidget *, iStream *outs, iBool withContent);
-void    deserializeState_DocumentWidget (iDocumentWidget *, iStream *ins);
+void    deserializeState_DocumentWidget (iDocumentWidget *, iStream *ins); /* leaves it dormant */
+iBool   isDormant_DocumentWidget        (const iDocumentWidget *);
+void    wakeUp_DocumentWidget           (iDocumentWidget *); /* create the document from history */
 
 iHistory *          history_DocumentWidget          (iDocumentWidget *);
 iWidget *           footerButtons_DocumentWidget    (const iDocumentWidget *);
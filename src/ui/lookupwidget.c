@@ -38,37 +38,151 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "util.h"
 #include "visited.h"
 
+#include <the_Foundation/atomic.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/thread.h>
-#include <the_Foundation/regexp.h>
+
+static const size_t maxPerType_LookupWidget_ = 10; /* TODO: Setting? */
+
+static int cmpPtr_LookupResult_(const void *p1, const void *p2) {
+    const iLookupResult *a = *(const iLookupResult **) p1;
+    const iLookupResult *b = *(const iLookupResult **) p2;
+    if (a->type != b->type) {
+        return iCmp(a->type, b->type);
+    }
+    if (fabsf(a->relevance - b->relevance) < 0.0001f) {
+        return cmpString_String(&a->url, &b->url);
+    }
+    return -iCmp(a->relevance, b->relevance);
+}
+
+/*----------------------------------------------------------------------------------------------*/
 
 iDeclareType(LookupJob)
 
 struct Impl_LookupJob {
-    iRegExp *term;
+    iLookupPattern *term;
+    iString query;
     iTime now;
     iObjectList *docs;
+    const iBookmarksSnapshot *bookmarks; /* taken in the main thread when the term was submitted */
+    const iAtomicInt *currentGen; /* job is abandoned when this no longer matches `gen` */
+    int gen;
+    iPtrArray best[max_LookupResultType]; /* min-heaps of the most relevant results per type */
     iPtrArray results;
 };
 
 static void init_LookupJob(iLookupJob *d) {
     d->term = NULL;
+    init_String(&d->query);
     initCurrent_Time(&d->now);
     d->docs = NULL;
+    d->bookmarks = NULL;
+    d->currentGen = NULL;
+    d->gen = 0;
+    iForIndices(i, d->best) {
+        init_PtrArray(&d->best[i]);
+    }
     init_PtrArray(&d->results);
 }
 
 static void deinit_LookupJob(iLookupJob *d) {
+    iForIndices(i, d->best) {
+        iForEach(PtrArray, j, &d->best[i]) {
+            delete_LookupResult(j.ptr);
+        }
+        deinit_PtrArray(&d->best[i]);
+    }
     iForEach(PtrArray, i, &d->results) {
         delete_LookupResult(i.ptr);
     }
     deinit_PtrArray(&d->results);
     iRelease(d->docs);
-    iRelease(d->term);
+    iRelease(d->bookmarks);
+    delete_LookupPattern(d->term);
+    deinit_String(&d->query);
 }
 
 iDefineTypeConstruction(LookupJob)
 
+static iBool isCancelled_LookupJob_(const iLookupJob *d) {
+    /* A newer term has been submitted. */
+    return d->currentGen && value_Atomic(d->currentGen) != d->gen;
+}
+
+static iBool isWorse_LookupResult_(const iLookupResult *a, const iLookupResult *b) {
+    return cmpPtr_LookupResult_(&a, &b) > 0;
+}
+
+static void siftDown_LookupJob_(iPtrArray *heap, size_t pos) {
+    const size_t n = size_PtrArray(heap);
+    for (;;) {
+        size_t worst = pos;
+        for (size_t child = 2 * pos + 1; child <= 2 * pos + 2 && child < n; child++) {
+            if (isWorse_LookupResult_(at_PtrArray(heap, child), at_PtrArray(heap, worst))) {
+                worst = child;
+            }
+        }
+        if (worst == pos) {
+            break;
+        }
+        void *tmp = at_PtrArray(heap, pos);
+        set_PtrArray(heap, pos, at_PtrArray(heap, worst));
+        set_PtrArray(heap, worst, tmp);
+        pos = worst;
+    }
+}
+
+static iBool isRelevantEnough_LookupJob_(const iLookupJob *d, enum iLookupResultType type,
+                                         float relevance) {
+    /* Only the most relevant results of each type are shown, so there is no need to
+       create results that would be discarded anyway. */
+    const iPtrArray *heap = &d->best[type];
+    if (relevance <= 0) {
+        return iFalse;
+    }
+    if (size_PtrArray(heap) <= maxPerType_LookupWidget_) {
+        return iTrue;
+    }
+    const iLookupResult *worst = constAt_PtrArray(heap, 0);
+    return relevance > worst->relevance - 0.0001f;
+}
+
+static void addResult_LookupJob_(iLookupJob *d, iLookupResult *res) {
+    /* Keeps the `maxPerType_LookupWidget_ + 1` best results, with the least relevant
+       one at the top of the heap. */
+    iPtrArray *heap = &d->best[res->type];
+    if (size_PtrArray(heap) <= maxPerType_LookupWidget_) {
+        pushBack_PtrArray(heap, res);
+        for (size_t pos = size_PtrArray(heap) - 1; pos > 0; ) {
+            const size_t parent = (pos - 1) / 2;
+            if (!isWorse_LookupResult_(res, at_PtrArray(heap, parent))) {
+                break;
+            }
+            set_PtrArray(heap, pos, at_PtrArray(heap, parent));
+            set_PtrArray(heap, parent, res);
+            pos = parent;
+        }
+        return;
+    }
+    if (isWorse_LookupResult_(res, at_PtrArray(heap, 0))) {
+        delete_LookupResult(res);
+        return;
+    }
+    delete_LookupResult(at_PtrArray(heap, 0));
+    set_PtrArray(heap, 0, res);
+    siftDown_LookupJob_(heap, 0);
+}
+
+static void collectResults_LookupJob_(iLookupJob *d) {
+    iForIndices(i, d->best) {
+        iForEach(PtrArray, j, &d->best[i]) {
+            pushBack_PtrArray(&d->results, j.ptr);
+        }
+        clear_PtrArray(&d->best[i]);
+    }
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 iDeclareType(LookupItem)
@@ -153,47 +267,39 @@ struct Impl_LookupWidget {
     iMutex *     mtx;
     iString      pendingTerm;
     iObjectList *pendingDocs;
+    const iBookmarksSnapshot *pendingBookmarks;
+    iAtomicInt   pendingGen; /* incremented when a new term is submitted */
+    iBool        isQuitting;
     iLookupJob * finishedJob;
 };
 
-static float scoreMatch_(const iRegExp *pattern, iRangecc text) {
-    float score = 0.0f;
-    iRegExpMatch m;
-    init_RegExpMatch(&m);
-    while (matchRange_RegExp(pattern, text, &m)) {
-        /* Match near the beginning is scored higher. */
-        score += (float) size_Range(&m.range) / ((float) m.range.start + 1);
-    }
-    return score;
-}
-
 static float bookmarkRelevance_LookupJob_(const iLookupJob *d, const iBookmark *bm) {
     if (isFolder_Bookmark(bm)) {
         return 0.0f;
     }
     iUrl parts;
     init_Url(&parts, &bm->url);
-    const float t = scoreMatch_(d->term, range_String(&bm->title));
-    const float h = scoreMatch_(d->term, parts.host);
-    const float p = scoreMatch_(d->term, parts.path);
-    const float g = scoreMatch_(d->term, range_String(&bm->tags));
+    const float t = score_LookupPattern(d->term, range_String(&bm->title));
+    const float h = score_LookupPattern(d->term, parts.host);
+    const float p = score_LookupPattern(d->term, parts.path);
+    const float g = score_LookupPattern(d->term, range_String(&bm->tags));
     return h + iMax(p, t) + 2 * g; /* extra weight for tags */
 }
 
 static float feedEntryRelevance_LookupJob_(const iLookupJob *d, const iFeedEntry *entry) {
     iUrl parts;
     init_Url(&parts, &entry->url);
-    const float t = scoreMatch_(d->term, range_String(&entry->title));
-    const float h = scoreMatch_(d->term, parts.host);
-    const float p = scoreMatch_(d->term, parts.path);
+    const float t = score_LookupPattern(d->term, range_String(&entry->title));
+    const float h = score_LookupPattern(d->term, parts.host);
+    const float p = score_LookupPattern(d->term, parts.path);
     const double age = secondsSince_Time(&d->now, &entry->posted) / 3600.0 / 24.0; /* days */
     return (t * 3 + h + p) / (age + 1); /* extra weight for title, recency */
 }
 
 static float identityRelevance_LookupJob_(const iLookupJob *d, const iGmIdentity *identity) {
     iString *cn = subject_TlsCertificate(identity->cert);
-    const float c = scoreMatch_(d->term, range_String(cn));
-    const float n = scoreMatch_(d->term, range_String(&identity->notes));
+    const float c = score_LookupPattern(d->term, range_String(cn));
+    const float n = score_LookupPattern(d->term, range_String(&identity->notes));
     delete_String(cn);
     return c + 2 * n; /* extra weight for notes */
 }
@@ -201,21 +307,23 @@ static float identityRelevance_LookupJob_(const iLookupJob *d, const iGmIdentity
 static float visitedRelevance_LookupJob_(const iLookupJob *d, const iVisitedUrl *vis) {
     iUrl parts;
     init_Url(&parts, &vis->url);
-    const float h = scoreMatch_(d->term, parts.host);
-    const float p = scoreMatch_(d->term, parts.path);
+    const float h = score_LookupPattern(d->term, parts.host);
+    const float p = score_LookupPattern(d->term, parts.path);
     const double age = secondsSince_Time(&d->now, &vis->when) / 3600.0 / 24.0; /* days */
     return iMax(h, p) / (age + 1); /* extra weight for recency */
 }
 
 static float snippetRelevance_LookupJob_(const iLookupJob *d, const iRangecc name,
                                          const iRangecc content) {
-    const float n = scoreMatch_(d->term, name);
-    const float c = scoreMatch_(d->term, content);
+    const float n = score_LookupPattern(d->term, name);
+    const float c = score_LookupPattern(d->term, content);
     return 4 * n + c;
 }
 
 static iBool matchBookmark_LookupJob_(void *context, const iBookmark *bm) {
-    return bookmarkRelevance_LookupJob_(context, bm) > 0;
+    return !isCancelled_LookupJob_(context) &&
+           isRelevantEnough_LookupJob_(
+               context, bookmark_LookupResultType, bookmarkRelevance_LookupJob_(context, bm));
 }
 
 static iBool matchIdentity_LookupJob_(void *context, const iGmIdentity *identity) {
@@ -227,9 +335,11 @@ static iBool matchSnippet_LookupJob_(void *context, const iRangecc name, const i
 }
 
 static void searchBookmarks_LookupJob_(iLookupJob *d) {
-    /* Note: Called in a background thread. */
-    /* TODO: Thread safety! What if a bookmark gets deleted while its being accessed here? */
-    iConstForEach(PtrArray, i, list_Bookmarks(bookmarks_App(), NULL, matchBookmark_LookupJob_, d)) {
+    /* Note: Called in a background thread. The snapshot was taken in the main thread. */
+    iConstForEach(PtrArray,
+                  i,
+                  listMatching_BookmarksSnapshot(
+                      d->bookmarks, &d->query, NULL, matchBookmark_LookupJob_, d)) {
         const iBookmark *bm  = i.ptr;
         iLookupResult *  res = new_LookupResult();
         res->type            = bookmark_LookupResultType;
@@ -239,19 +349,22 @@ static void searchBookmarks_LookupJob_(iLookupJob *d) {
         set_String(&res->label, &bm->title);
         set_String(&res->url, &bm->url);
         set_String(&res->meta, &bm->identity);
-        pushBack_PtrArray(&d->results, res);
+        addResult_LookupJob_(d, res);
     }
 }
 
 static void searchFeeds_LookupJob_(iLookupJob *d) {
-    iConstForEach(PtrArray, i, listEntries_Feeds()) {
+    iConstForEach(PtrArray, i, listMatchingEntries_Feeds(&d->query)) {
+        if (isCancelled_LookupJob_(d)) {
+            break;
+        }
         const iFeedEntry *entry = i.ptr;
-        const iBookmark *bm = get_Bookmarks(bookmarks_App(), entry->bookmarkId);
+        const iBookmark *bm = get_BookmarksSnapshot(d->bookmarks, entry->bookmarkId);
         if (!bm) {
             continue;
         }
         const float relevance = feedEntryRelevance_LookupJob_(d, entry);
-        if (relevance > 0) {
+        if (isRelevantEnough_LookupJob_(d, feedEntry_LookupResultType, relevance)) {
             iLookupResult *res = new_LookupResult();
             res->type          = feedEntry_LookupResultType;
             res->when          = entry->posted;
@@ -260,57 +373,58 @@ static void searchFeeds_LookupJob_(iLookupJob *d) {
             set_String(&res->meta, &bm->title);
             set_String(&res->label, &entry->title);
             res->icon = bm->icon;
-            pushBack_PtrArray(&d->results, res);
+            addResult_LookupJob_(d, res);
         }
     }
 }
 
 static void searchVisited_LookupJob_(iLookupJob *d) {
-    /* Note: Called in a background thread. */
-    /* TODO: Thread safety! Visited URLs may be deleted while being accessed here. */
-    iConstForEach(PtrArray, i, list_Visited(visited_App(), 0)) {
+    /* Note: Called in a background thread. The listed URLs are an immutable snapshot. */
+    iConstForEach(PtrArray, i, listMatching_Visited(visited_App(), &d->query)) {
+        if (isCancelled_LookupJob_(d)) {
+            break;
+        }
         const iVisitedUrl *vis = i.ptr;
         const float relevance = visitedRelevance_LookupJob_(d, vis);
-        if (relevance > 0) {
+        if (isRelevantEnough_LookupJob_(d, history_LookupResultType, relevance)) {
             iLookupResult *res = new_LookupResult();
             res->type = history_LookupResultType;
             res->relevance = relevance;
             set_String(&res->label, &vis->url);
             set_String(&res->url, &vis->url);
             res->when = vis->when;
-            pushBack_PtrArray(&d->results, res);
+            addResult_LookupJob_(d, res);
         }
     }
 }
 
 static void searchHistory_LookupJob_(iLookupJob *d) {
     /* Note: Called in a background thread. */
-    size_t index = 0;
+    iPtrArray *histories = new_PtrArray();
     iForEach(ObjectList, i, d->docs) {
-        iConstForEach(StringArray, j,
-                      searchContents_History(history_DocumentWidget(i.object), d->term)) {
-            const char *match = cstr_String(j.value);
-            const size_t matchLen = argLabel_Command(match, "len");
-            iRangecc text;
-            const char *strArg = strstr(match, " str:");
-            if (strArg) {
-                text.start = strArg + 5;
-                text.end = text.start + matchLen;
-                const char *urlArg = strstr(text.end, " url:");
-                if (urlArg) {
-                    const char *url = urlArg + 5;
-                    iLookupResult *res = new_LookupResult();
-                    res->type = content_LookupResultType;
-                    res->relevance = ++index; /* most recent comes last */
-                    setCStr_String(&res->label, "\"");
-                    appendRange_String(&res->label, text);
-                    appendCStr_String(&res->label, "\"");
-                    setCStr_String(&res->url, url);
-                    pushBack_PtrArray(&d->results, res);
-                }
-            }
+        pushBack_PtrArray(histories, history_DocumentWidget(i.object));
+    }
+    iPtrArray *matches = searchContent_History(histories, &d->query, 20);
+    iForEach(PtrArray, j, matches) {
+        iContentMatch *match = j.ptr;
+        iLookupResult *res = new_LookupResult();
+        res->type = content_LookupResultType;
+        res->relevance = match->relevance;
+        /* Highlight the matched word. */
+        iString *text = &match->snippet;
+        if (match->mark.end < (int) size_String(text)) {
+            insertData_Block(&text->chars, match->mark.end, uiText_ColorEscape, 2);
         }
+        insertData_Block(&text->chars, match->mark.start, uiTextStrong_ColorEscape, 2);
+        setCStr_String(&res->label, "\"");
+        append_String(&res->label, text);
+        appendCStr_String(&res->label, "\"");
+        set_String(&res->url, &match->url);
+        addResult_LookupJob_(d, res);
+        delete_ContentMatch(match);
     }
+    delete_PtrArray(matches);
+    delete_PtrArray(histories);
 }
 
 static void searchIdentities_LookupJob_(iLookupJob *d) {
@@ -327,7 +441,7 @@ static void searchIdentities_LookupJob_(iLookupJob *d) {
         set_String(&res->meta,
                    collect_String(
                        hexEncode_Block(collect_Block(fingerprint_TlsCertificate(identity->cert)))));
-        pushBack_PtrArray(&d->results, res);
+        addResult_LookupJob_(d, res);
     }
 }
 
@@ -344,7 +458,7 @@ static void searchSnippets_LookupJob_(iLookupJob *d) {
         content = part;
         if (!isEmpty_Range(&name) && !isEmpty_Range(&content)) {
             const float relevance = snippetRelevance_LookupJob_(d, name, content);
-            if (relevance > 0) {
+            if (isRelevantEnough_LookupJob_(d, snippet_LookupResultType, relevance)) {
                 iLookupResult *res = new_LookupResult();
                 res->type = snippet_LookupResultType;
                 res->relevance = relevance;
@@ -352,7 +466,7 @@ static void searchSnippets_LookupJob_(iLookupJob *d) {
                 setRange_String(&res->label, name);
                 setRange_String(&res->meta, content);
                 replace_String(&res->meta, "\n", return_Icon " ");
-                pushBack_PtrArray(&d->results, res);
+                addResult_LookupJob_(d, res);
             }
         }
     }
@@ -363,54 +477,54 @@ static iThreadResult worker_LookupWidget_(iThread *thread) {
 //    printf("[LookupWidget] worker is running\n"); fflush(stdout);
     lock_Mutex(d->mtx);
     for (;;) {
-        wait_Condition(&d->jobAvailable, d->mtx);
-        if (isEmpty_String(&d->pendingTerm)) {
-            break; /* Time to quit. */
+        /* A term may have been submitted while the previous job was running. */
+        while (isEmpty_String(&d->pendingTerm) && !d->isQuitting) {
+            wait_Condition(&d->jobAvailable, d->mtx);
         }
-        iLookupJob *job = new_LookupJob();
-        /* Make a regular expression to search for multiple alternative words. */ {
-            iString *pattern = new_String();
-            iRangecc word = iNullRange;
-            iBool isFirst = iTrue;
-            iString wordStr;
-            init_String(&wordStr);
-            while (nextSplit_Rangecc(range_String(&d->pendingTerm), " ", &word)) {
-                if (isEmpty_Range(&word)) continue;
-                if (!isFirst) appendCStr_String(pattern, ".*");
-                setRange_String(&wordStr, word);
-                iConstForEach(String, ch, &wordStr) {
-                    /* Escape regular expression characters. */
-                    if (isSyntaxChar_RegExp(ch.value)) {
-                        appendChar_String(pattern, '\\');
-                    }
-                    appendChar_String(pattern, ch.value);
-                }
-                isFirst = iFalse;
-            }
-            deinit_String(&wordStr);
-            iAssert(!isEmpty_String(pattern));
-            job->term = new_RegExp(cstr_String(pattern), caseInsensitive_RegExpOption);
-            delete_String(pattern);
+        if (d->isQuitting) {
+            break;
         }
+        iLookupJob *job = new_LookupJob();
+        job->currentGen = &d->pendingGen;
+        job->gen        = value_Atomic(&d->pendingGen);
+        job->term = new_LookupPattern(&d->pendingTerm);
         const size_t termLen = length_String(&d->pendingTerm); /* characters */
+        set_String(&job->query, &d->pendingTerm);
         const iBool snippetsOnly = !cmp_String(&d->pendingTerm, "!");
         clear_String(&d->pendingTerm);
         job->docs = d->pendingDocs;
+        job->bookmarks = d->pendingBookmarks;
         d->pendingDocs = NULL;
+        d->pendingBookmarks = NULL;
         unlock_Mutex(d->mtx);
-        /* Do the lookup. */
+        /* Snapshots and lists collected during the job are released when it's done. */
+        iBeginCollect();
+        /* Do the lookup. Each step is skipped if a newer term has been submitted. */
         if (!snippetsOnly) {
-            searchBookmarks_LookupJob_(job);
-            searchFeeds_LookupJob_(job);
-            searchVisited_LookupJob_(job);
-            if (termLen >= 3) {
-                searchHistory_LookupJob_(job);
+            void (*steps[])(iLookupJob *) = {
+                searchBookmarks_LookupJob_,
+                searchFeeds_LookupJob_,
+                searchVisited_LookupJob_,
+                termLen >= 3 ? searchHistory_LookupJob_ : NULL,
+                searchIdentities_LookupJob_,
+            };
+            iForIndices(i, steps) {
+                if (steps[i] && !isCancelled_LookupJob_(job)) {
+                    steps[i](job);
+                }
             }
-            searchIdentities_LookupJob_(job);
         }
-        searchSnippets_LookupJob_(job);
+        if (!isCancelled_LookupJob_(job)) {
+            searchSnippets_LookupJob_(job);
+        }
+        collectResults_LookupJob_(job);
+        iEndCollect();
         /* Submit the result. */
         lock_Mutex(d->mtx);
+        if (isCancelled_LookupJob_(job)) {
+            delete_LookupJob(job);
+            continue;
+        }
         if (d->finishedJob) {
             /* Previous results haven't been taken yet. */
             delete_LookupJob(d->finishedJob);
@@ -452,6 +566,9 @@ void init_LookupWidget(iLookupWidget *d) {
     d->mtx = new_Mutex();
     init_String(&d->pendingTerm);
     d->pendingDocs = NULL;
+    d->pendingBookmarks = NULL;
+    set_Atomic(&d->pendingGen, 0);
+    d->isQuitting = iFalse;
     d->finishedJob = NULL;
     updateMetrics_LookupWidget_(d);
     start_Thread(d->work);
@@ -461,7 +578,10 @@ void deinit_LookupWidget(iLookupWidget *d) {
     /* Stop the worker. */ {
         iGuardMutex(d->mtx, {
             iReleasePtr(&d->pendingDocs);
+            iReleasePtr(&d->pendingBookmarks);
             clear_String(&d->pendingTerm);
+            add_Atomic(&d->pendingGen, 1);
+            d->isQuitting = iTrue;
             signal_Condition(&d->jobAvailable);
         });
         join_Thread(d->work);
@@ -477,9 +597,12 @@ void submit_LookupWidget(iLookupWidget *d, const iString *term) {
     iGuardMutex(d->mtx, {
         set_String(&d->pendingTerm, term);
         trim_String(&d->pendingTerm);
+        add_Atomic(&d->pendingGen, 1); /* abandon the running job */
         iReleasePtr(&d->pendingDocs);
+        iReleasePtr(&d->pendingBookmarks);
         if (!isEmpty_String(&d->pendingTerm)) {
             d->pendingDocs = listDocuments_App(get_Root()); /* holds reference to all open tabs */
+            d->pendingBookmarks = ref_Object(snapshot_Bookmarks(bookmarks_App()));
             signal_Condition(&d->jobAvailable);
         }
         else {
@@ -500,18 +623,6 @@ static void draw_LookupWidget_(const iLookupWidget *d) {
     }
 }
 
-static int cmpPtr_LookupResult_(const void *p1, const void *p2) {
-    const iLookupResult *a = *(const iLookupResult **) p1;
-    const iLookupResult *b = *(const iLookupResult **) p2;
-    if (a->type != b->type) {
-        return iCmp(a->type, b->type);
-    }
-    if (fabsf(a->relevance - b->relevance) < 0.0001f) {
-        return cmpString_String(&a->url, &b->url);
-    }
-    return -iCmp(a->relevance, b->relevance);
-}
-
 static const char *cstr_LookupResultType(enum iLookupResultType d) {
     switch (d) {
         case bookmark_LookupResultType:
@@ -541,7 +652,6 @@ static void presentResults_LookupWidget_(iLookupWidget *d) {
     clear_ListWidget(d->list);
     sort_Array(&job->results, cmpPtr_LookupResult_);
     enum iLookupResultType lastType = none_LookupResultType;
-    const size_t maxPerType = 10; /* TODO: Setting? */
     size_t perType = 0;
     iConstForEach(PtrArray, i, &job->results) {
         const iLookupResult *res = i.ptr;
@@ -557,7 +667,7 @@ static void presentResults_LookupWidget_(iLookupWidget *d) {
             lastType = res->type;
             perType = 0;
         }
-        if (perType > maxPerType) {
+        if (perType > maxPerType_LookupWidget_) {
             continue;
         }
         if (res->type == identity_LookupResultType) {
@@ -662,6 +662,11 @@ static void updateItemsWithFlags_SidebarWidget_(iSidebarWidget *d, iBool keepAct
                 addActionButton_SidebarWidget_(d, add_Icon " ${sidebar.action.ident.new}", "ident.new", 0);
                 addActionButton_SidebarWidget_(d, "${sidebar.action.ident.import}", "ident.import", 0);
             }
+            if (numPendingIdentities_GmCerts(certs_App())) {
+                /* Key generation is still running in the background. */
+                addActionButton_SidebarWidget_(
+                    d, hourglass_Icon " ${sidebar.action.ident.generating}", NULL, disabled_WidgetFlag);
+            }
             break;
         }
         default:
@@ -1201,6 +1206,7 @@ iBool handleBookmarkEditorCommands_SidebarWidget_(iWidget *editor, const char *c
         iBookmark *bm = get_Bookmarks(bookmarks_App(), bmId);
         if (bm) {
             set_String(&bm->identity, string_Command(cmd, "fp"));
+            invalidate_Bookmarks(bookmarks_App());
             updateDropdownSelection_LabelWidget(findChild_Widget(editor, "bmed.setident"),
                                                 format_CStr(" fp:%s", cstr_String(&bm->identity)));
         }
@@ -1237,6 +1243,7 @@ iBool handleBookmarkEditorCommands_SidebarWidget_(iWidget *editor, const char *c
             if (!folder || !hasParent_Bookmark(folder, id_Bookmark(bm))) {
                 bm->parentId = folder ? id_Bookmark(folder) : 0;
             }
+            invalidate_Bookmarks(bookmarks_App());
             postCommand_App("bookmarks.changed");
         }
         setupSheetTransition_Mobile(editor, dialogTransitionDir_Widget(editor));
@@ -1431,6 +1438,7 @@ static void bookmarkMovedOntoFolder_SidebarWidget_(iSidebarWidget *d, size_t ind
     const iSidebarItem *dstItem    = item_ListWidget(d->list, folderIndex);
     iBookmark *bm = get_Bookmarks(bookmarks_App(), movingItem->id);
     bm->parentId = dstItem->id;
+    invalidate_Bookmarks(bookmarks_App());
     postCommand_App("bookmarks.changed");
 }
 
@@ -1779,6 +1787,7 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
                     removeEntries_Feeds(item->id); /* get rid of unsubscribed entries */
                 }
                 bm->flags ^= flag;
+                invalidate_Bookmarks(bookmarks_App());
                 postCommand_App("bookmarks.changed");
             }
             return iTrue;
@@ -1856,7 +1865,8 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
             }
             return iTrue;
         }
-        else if (equal_Command(cmd, "feeds.update.finished")) {
+        else if (equal_Command(cmd, "feeds.update.finished") ||
+                 equal_Command(cmd, "feeds.update.loaded")) {
             d->numUnreadEntries = argLabel_Command(cmd, "unread");
             checkModeButtonLayout_SidebarWidget_(d);
             if (d->mode == feeds_SidebarMode) {
@@ -1948,7 +1958,9 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
                     if (isCommand_Widget(w, ev, "feed.entry.unsubscribe")) {
                         if (arg_Command(cmd)) {
                             feedBookmark->flags &= ~subscribed_BookmarkFlag;
+                            invalidate_Bookmarks(bookmarks_App());
                             removeEntries_Feeds(id_Bookmark(feedBookmark));
+                            postCommand_App("bookmarks.changed");
                             updateItems_SidebarWidget_(d);
                         }
                         else {
@@ -79,6 +79,18 @@ void    resetMissing_Text       (iText *);
 iBool   checkMissing_Text       (void); /* returns the flag, and clears it */
 SDL_Texture *glyphCache_Text    (void);
 
+iDeclareType(GlyphCacheStats)
+
+struct Impl_GlyphCacheStats {
+    unsigned hits;      /* glyph was found in the cache */
+    unsigned misses;    /* glyph had to be allocated in the cache */
+    unsigned evictions; /* pages emptied to make room for new glyphs */
+    int      numPages;
+    int      maxPages;  /* limited by the memory budget */
+};
+
+iGlyphCacheStats glyphCacheStats_Text(void);
+
 /*----------------------------------------------------------------------------------------------*/
 
 int     lineHeight_Text         (int fontId);
@@ -82,7 +82,7 @@ static void runSimple_Font_(iFont *d, const iRunArgs *args) {
     const char *        lastWordEnd = args->text.start;
     SDL_Renderer *render = current_Text()->render;
 #if defined (LAGRANGE_ENABLE_STB_TRUETYPE)
-    SDL_Texture *cache = current_StbText_()->cache;
+    iStbText *tx = current_StbText_();
 #endif
     iAssert(args->text.end >= args->text.start);
     if (wrap) {
@@ -101,7 +101,7 @@ static void runSimple_Font_(iFont *d, const iRunArgs *args) {
     if (mode & draw_RunMode) {
         const iColor clr = get_Color(args->color);
 #if defined (LAGRANGE_ENABLE_STB_TRUETYPE)
-        SDL_SetTextureColorMod(cache, clr.r, clr.g, clr.b);
+        setColorMod_StbText_(tx, clr);
 #endif
 #if defined (SDL_SEAL_CURSES)
         const enum iFontStyle style = style_FontId(fontId_Text(d));
@@ -152,7 +152,7 @@ static void runSimple_Font_(iFont *d, const iRunArgs *args) {
                                      NULL,
                                      NULL);
 #if defined (LAGRANGE_ENABLE_STB_TRUETYPE)
-                    SDL_SetTextureColorMod(cache, clr.r, clr.g, clr.b);
+                    setColorMod_StbText_(tx, clr);
 #endif
 #if defined (SDL_SEAL_CURSES)
                     SDL_SetRenderTextColor(render, clr.r, clr.g, clr.b);
@@ -246,7 +246,7 @@ static void runSimple_Font_(iFont *d, const iRunArgs *args) {
                 if (mode & draw_RunMode && ~mode & permanentColorFlag_RunMode) {
                     const iColor clr = get_Color(colorNum);
 #if defined (LAGRANGE_ENABLE_STB_TRUETYPE)
-                    SDL_SetTextureColorMod(cache, clr.r, clr.g, clr.b);
+                    setColorMod_StbText_(tx, clr);
 #endif
 #if defined (SDL_SEAL_CURSES)
                     SDL_SetRenderTextColor(render, clr.r, clr.g, clr.b);
@@ -362,7 +362,7 @@ static void runSimple_Font_(iFont *d, const iRunArgs *args) {
                 SDL_RenderFillRect(render, &dst);
             }
 #if defined (LAGRANGE_ENABLE_STB_TRUETYPE)
-            SDL_RenderCopy(render, cache, &src, &dst);
+            SDL_RenderCopy(render, glyphTexture_StbText_(tx, glyph), &src, &dst);
 #endif
 #if defined (SDL_SEAL_CURSES)
             SDL_RenderDrawUnicode(render, dst.x, dst.y, ch);
@@ -24,7 +24,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 - Text : top-level text renderer instance (one per window)
 - Font : a font's assets for rendering, e.g., metrics and cached glyphs
-- Glyph : hash node; a single cached glyph, with Rect in cache texture
+- Glyph : a single cached glyph, with Rect in a glyph cache page
+- GlyphPage : one texture of the glyph cache; glyphs are packed into it in rows
 - AttributedText : text string to be drawn that is split into sub-runs by attributes (font, color)
 - AttributedRun : a run inside AttributedText
 - GlyphBuffer : HarfBuzz-shaped glyphs corresponding to an AttributedRun
@@ -81,6 +82,11 @@ Optimization notes:
 #   define LAGRANGE_RASTER_FORMAT   SDL_PIXELFORMAT_RGBA8888
 #endif
 
+/* Glyph cache pages contain white pixels with the glyph coverage as alpha, and glyphs are
+   colored by texture modulation. SDL has no single-channel texture format, so this is the
+   smallest one that has an alpha channel. */
+#define LAGRANGE_GLYPH_CACHE_FORMAT SDL_PIXELFORMAT_RGBA4444
+
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "../stb_truetype.h"
 
@@ -120,18 +126,20 @@ static int makeRasterizedAll_GlyphFlag_(int n) {
 }
 
 struct Impl_Glyph {
-    iHashNode node;
+    uint32_t  index;   /* glyph index in the font */
     int       flags;
     iFont    *font;    /* may come from symbols/emoji */
+    int       page;    /* all offsets are in the same page of the glyph cache */
     float     advance; /* scaled */
     iRect     rect[4]; /* zero and half pixel offset */
     iInt2     d[4];
 };
 
 void init_Glyph(iGlyph *d, uint32_t glyphIndex) {
-    d->node.key   = glyphIndex;
+    d->index      = glyphIndex;
     d->flags      = 0;
     d->font       = NULL;
+    d->page       = 0;
     d->advance    = 0.0f;
     iZap(d->rect);
     iZap(d->d);
@@ -142,7 +150,7 @@ void deinit_Glyph(iGlyph *d) {
 }
 
 static uint32_t index_Glyph_(const iGlyph *d) {
-    return d->node.key;
+    return d->index;
 }
 
 iLocalDef iBool isRasterized_Glyph_(const iGlyph *d, int hoff) {
@@ -164,31 +172,71 @@ iDefineTypeConstructionArgs(Glyph, (iChar ch), ch)
 static iGlyph *glyph_Font_(iFont *d, iChar ch);
 
 iDeclareType(GlyphTable)
+iDeclareType(CharGlyphIndex)
+
+/* Glyph indices are 16-bit, so the glyphs are in 256 blocks of 256 glyphs. Blocks are
+   allocated when a glyph in them is first needed. */
+enum iGlyphTableSize {
+    numBlocks_GlyphTable_         = 256,
+    numGlyphsPerBlock_GlyphTable_ = 256,
+    numRecentChars_GlyphTable_    = 256, /* power of two */
+};
+
+struct Impl_CharGlyphIndex {
+    iChar    ch;
+    uint32_t glyphIndex;
+};
 
 struct Impl_GlyphTable {
-    iHash          glyphs; /* key is glyph index in the font */
-    /* TODO: `glyphs` does not need to be a Hash.
-       We could lazily allocate an array with glyphCount elements instead. */
-    uint32_t       indexTable[128 - 32]; /* quick ASCII lookup */
+    iGlyph **       blocks[numBlocks_GlyphTable_]; /* high byte of the glyph index selects the block */
+    uint32_t        indexTable[128 - 32]; /* quick ASCII lookup */
+    iCharGlyphIndex recentChars[numRecentChars_GlyphTable_]; /* direct-mapped by character */
 };
 
 static void clearGlyphs_GlyphTable_(iGlyphTable *d) {
     if (d) {
-        iForEach(Hash, i, &d->glyphs) {
-            delete_Glyph((iGlyph *) i.value);
+        iForIndices(b, d->blocks) {
+            if (d->blocks[b]) {
+                for (size_t i = 0; i < numGlyphsPerBlock_GlyphTable_; i++) {
+                    delete_Glyph(d->blocks[b][i]);
+                }
+                free(d->blocks[b]);
+                d->blocks[b] = NULL;
+            }
         }
-        clear_Hash(&d->glyphs);
+    }
+}
+
+iLocalDef iGlyph *glyph_GlyphTable_(const iGlyphTable *d, uint32_t glyphIndex) {
+    iGlyph **block = d->blocks[(glyphIndex >> 8) & 0xff];
+    return block ? block[glyphIndex & 0xff] : NULL;
+}
+
+static void insert_GlyphTable_(iGlyphTable *d, iGlyph *glyph) {
+    const uint32_t glyphIndex = index_Glyph_(glyph);
+    iAssert(glyphIndex < numBlocks_GlyphTable_ * numGlyphsPerBlock_GlyphTable_);
+    iGlyph ***block = &d->blocks[(glyphIndex >> 8) & 0xff];
+    if (!*block) {
+        *block = calloc(numGlyphsPerBlock_GlyphTable_, sizeof(iGlyph *));
+    }
+    (*block)[glyphIndex & 0xff] = glyph;
+}
+
+static void remove_GlyphTable_(iGlyphTable *d, uint32_t glyphIndex) {
+    iGlyph **block = d->blocks[(glyphIndex >> 8) & 0xff];
+    if (block) {
+        block[glyphIndex & 0xff] = NULL;
     }
 }
 
 static void init_GlyphTable(iGlyphTable *d) {
-    init_Hash(&d->glyphs);
+    iZap(d->blocks);
     memset(d->indexTable, 0xff, sizeof(d->indexTable));
+    memset(d->recentChars, 0xff, sizeof(d->recentChars)); /* not a valid character */
 }
 
 static void deinit_GlyphTable(iGlyphTable *d) {
     clearGlyphs_GlyphTable_(d);
-    deinit_Hash(&d->glyphs);
 }
 
 iDefineTypeConstruction(GlyphTable)
@@ -232,7 +280,6 @@ static void deinit_Font(iFont *d) {
 }
 
 static uint32_t glyphIndex_Font_(iFont *d, iChar ch) {
-    /* TODO: Add a small cache of ~5 most recently found indices. */
     const size_t entry = ch - 32;
     if (!d->table) {
         d->table = new_GlyphTable();
@@ -244,7 +291,15 @@ static uint32_t glyphIndex_Font_(iFont *d, iChar ch) {
         }
         return table->indexTable[entry];
     }
-    return findGlyphIndex_FontFile(d->font.file, ch);
+    /* Other characters are remembered in a small cache; text in most scripts reuses only
+       a limited set of characters. */
+    iCharGlyphIndex *recent =
+        &table->recentChars[(ch * 2654435761u >> 16) & (numRecentChars_GlyphTable_ - 1)];
+    if (recent->ch != ch) {
+        recent->ch         = ch;
+        recent->glyphIndex = findGlyphIndex_FontFile(d->font.file, ch);
+    }
+    return recent->glyphIndex;
 }
 
 /*----------------------------------------------------------------------------------------------*/
@@ -256,6 +311,20 @@ struct Impl_CacheRow {
     iInt2 pos;
 };
 
+iDeclareType(GlyphPage)
+
+struct Impl_GlyphPage {
+    SDL_Texture *texture;
+    int          bottom;   /* rows are allocated downwards */
+    iArray       rows;     /* CacheRows by glyph height */
+    iPtrArray    glyphs;   /* all glyphs allocated in the page; discarded together */
+    uint32_t     lastUsed; /* for finding the least recently used page */
+};
+
+/* Pages are added as needed until the total size of the glyph cache textures reaches the
+   budget. After that, the least recently used page is emptied for new glyphs. */
+static const size_t maxCacheBytes_StbText_ = 32 * 1024 * 1024;
+
 iDeclareType(PrioMapItem)
 struct Impl_PrioMapItem {
     int      priority;
@@ -279,11 +348,17 @@ struct Impl_StbText {
     iArray         fonts; /* fonts currently selected for use (incl. all styles/sizes) */
     int            overrideFontId; /* always checked for glyphs first, regardless of which font is used */
     iArray         fontPriorityOrder;
-    SDL_Texture *  cache;
-    iInt2          cacheSize;
+    iArray         cachePages; /* GlyphPages */
+    int            currentPage; /* new glyphs are allocated here */
+    int            maxPages;
+    iInt2          cacheSize;   /* of each page */
     int            cacheRowAllocStep;
-    int            cacheBottom;
-    iArray         cacheRows;
+    int            numCacheRows;
+    uint32_t       cacheUseCounter;
+    uint32_t       cacheGeneration; /* incremented whenever cached glyphs are discarded */
+    iColor         cacheColorMod;
+    uint8_t        cacheAlphaMod;
+    iGlyphCacheStats cacheStats;
     SDL_Palette *  grayscale;
     SDL_Palette *  blackAndWhite; /* unsmoothed glyph palette */
     iBool          missingGlyphs;  /* true if a glyph couldn't be found */
@@ -387,8 +462,38 @@ static int maxGlyphHeight_Text_(const iText *d) {
     return 4 * d->contentFontSize * fontSize_UI;
 }
 
+static void init_GlyphPage(iGlyphPage *d, const iStbText *tx) {
+    init_Array(&d->rows, sizeof(iCacheRow));
+    for (int i = 0; i < tx->numCacheRows; i++) {
+        /* Rows are assigned actual locations in the page once a glyph is stored. */
+        pushBack_Array(&d->rows, &(iCacheRow){ .height = 0 });
+    }
+    d->bottom = 0;
+    init_PtrArray(&d->glyphs);
+    d->lastUsed = tx->cacheUseCounter;
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    /* Glyphs are uploaded directly in the page format, so it doesn't need to be a render
+       target. */
+    d->texture = SDL_CreateTexture(tx->base.render,
+                                   LAGRANGE_GLYPH_CACHE_FORMAT,
+                                   SDL_TEXTUREACCESS_STATIC,
+                                   tx->cacheSize.x,
+                                   tx->cacheSize.y);
+    SDL_SetTextureBlendMode(d->texture, SDL_BLENDMODE_BLEND);
+    SDL_SetTextureColorMod(d->texture, tx->cacheColorMod.r, tx->cacheColorMod.g,
+                           tx->cacheColorMod.b);
+    SDL_SetTextureAlphaMod(d->texture, tx->cacheAlphaMod);
+}
+
+static void deinit_GlyphPage(iGlyphPage *d) {
+    /* Note: The glyphs are owned by the glyph tables of the fonts. */
+    deinit_PtrArray(&d->glyphs);
+    deinit_Array(&d->rows);
+    SDL_DestroyTexture(d->texture);
+}
+
 static void initCache_StbText_(iStbText *d) {
-    init_Array(&d->cacheRows, sizeof(iCacheRow));
+    init_Array(&d->cachePages, sizeof(iGlyphPage));
     const int textSize = d->base.contentFontSize * fontSize_UI;
     iAssert(textSize > 0);
     numOffsetSteps_Glyph_   = get_Window()->pixelRatio < 2.0f   ? 4
@@ -406,27 +511,42 @@ static void initCache_StbText_(iStbText *d) {
         d->cacheSize.y = renderInfo.max_texture_height;
         d->cacheSize.x = renderInfo.max_texture_width;
     }
+    d->maxPages = iMax(2, (int) (maxCacheBytes_StbText_ /
+                                 ((size_t) d->cacheSize.x * d->cacheSize.y *
+                                  SDL_BYTESPERPIXEL(LAGRANGE_GLYPH_CACHE_FORMAT))));
     d->cacheRowAllocStep = iMax(2, textSize / 6);
-    /* Allocate initial (empty) rows. These will be assigned actual locations in the cache
-       once at least one glyph is stored. */
-    for (int h = d->cacheRowAllocStep;
-         h <= 5 * textSize + d->cacheRowAllocStep;
-         h += d->cacheRowAllocStep) {
-        pushBack_Array(&d->cacheRows, &(iCacheRow){ .height = 0 });
-    }
-    d->cacheBottom = 0;
-    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
-    d->cache = SDL_CreateTexture(d->base.render,
-                                 SDL_PIXELFORMAT_RGBA4444,
-                                 SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
-                                 d->cacheSize.x,
-                                 d->cacheSize.y);
-    SDL_SetTextureBlendMode(d->cache, SDL_BLENDMODE_BLEND);
+    d->numCacheRows      = (5 * textSize + d->cacheRowAllocStep) / d->cacheRowAllocStep;
+    /* The first page is created right away; more are added when it fills up. */
+    pushBack_Array(&d->cachePages, &(iGlyphPage){ .texture = NULL });
+    init_GlyphPage(at_Array(&d->cachePages, 0), d);
+    d->currentPage = 0;
 }
 
 static void deinitCache_StbText_(iStbText *d) {
-    deinit_Array(&d->cacheRows);
-    SDL_DestroyTexture(d->cache);
+    iForEach(Array, i, &d->cachePages) {
+        deinit_GlyphPage(i.value);
+    }
+    deinit_Array(&d->cachePages);
+    d->cacheGeneration++;
+}
+
+iLocalDef iGlyphPage *page_StbText_(iStbText *d, int page) {
+    return at_Array(&d->cachePages, page);
+}
+
+iLocalDef SDL_Texture *glyphTexture_StbText_(iStbText *d, const iGlyph *glyph) {
+    return page_StbText_(d, glyph->page)->texture;
+}
+
+static void setColorMod_StbText_(iStbText *d, iColor color) {
+    if (color.r == d->cacheColorMod.r && color.g == d->cacheColorMod.g &&
+        color.b == d->cacheColorMod.b) {
+        return;
+    }
+    d->cacheColorMod = color;
+    iForEach(Array, i, &d->cachePages) {
+        SDL_SetTextureColorMod(((iGlyphPage *) i.value)->texture, color.r, color.g, color.b);
+    }
 }
 
 void init_StbText(iStbText *d, SDL_Renderer *render, float documentFontSizeFactor) {
@@ -438,6 +558,11 @@ void init_StbText(iStbText *d, SDL_Renderer *render, float documentFontSizeFacto
     d->missingGlyphs   = iFalse;
     iZap(d->missingChars);
     iZap(d->cachedFontRuns);
+    d->cacheUseCounter = 0;
+    d->cacheGeneration = 0;
+    d->cacheColorMod   = (iColor){ 255, 255, 255, 255 };
+    d->cacheAlphaMod   = 255;
+    iZap(d->cacheStats);
     /* A grayscale palette for rasterized glyphs. */ {
         SDL_Color colors[256];
         for (int i = 0; i < 256; ++i) {
@@ -487,7 +612,11 @@ void delete_Text(iText *d) {
 }
 
 void setOpacity_Text(float opacity) {
-    SDL_SetTextureAlphaMod(current_StbText_()->cache, iClamp(opacity, 0.0f, 1.0f) * 255 + 0.5f);
+    iStbText *d = current_StbText_();
+    d->cacheAlphaMod = iClamp(opacity, 0.0f, 1.0f) * 255 + 0.5f;
+    iForEach(Array, i, &d->cachePages) {
+        SDL_SetTextureAlphaMod(((iGlyphPage *) i.value)->texture, d->cacheAlphaMod);
+    }
 }
 
 static void resetCache_StbText_(iStbText *d) {
@@ -541,42 +670,92 @@ static SDL_Surface *rasterizeGlyph_Font_(const iFont *d, uint32_t glyphIndex, fl
 #endif
 }
 
-iLocalDef iCacheRow *cacheRow_StbText_(iStbText *d, int height) {
-    return at_Array(&d->cacheRows, (height - 1) / d->cacheRowAllocStep);
+static void evictPage_StbText_(iStbText *d, int pageIndex) {
+    /* All glyphs of the page are forgotten, and they will be rasterized again when needed. */
+    iGlyphPage *page = page_StbText_(d, pageIndex);
+    iForEach(PtrArray, i, &page->glyphs) {
+        iGlyph *glyph = i.ptr;
+        remove_GlyphTable_(glyph->font->table, index_Glyph_(glyph));
+        delete_Glyph(glyph);
+    }
+    clear_PtrArray(&page->glyphs);
+    iForEach(Array, r, &page->rows) {
+        *(iCacheRow *) r.value = (iCacheRow){ .height = 0 };
+    }
+    page->bottom = 0;
+    d->cacheGeneration++;
+    d->cacheStats.evictions++;
+#if !defined (NDEBUG)
+    printf("[Text] glyph cache page %d evicted (hits:%u misses:%u evictions:%u)\n",
+           pageIndex,
+           d->cacheStats.hits,
+           d->cacheStats.misses,
+           d->cacheStats.evictions);
+    fflush(stdout);
+#endif
 }
 
-static iInt2 assignCachePos_Text_(iStbText *d, iInt2 size) {
-    iCacheRow *cur = cacheRow_StbText_(d, size.y);
+static iGlyphPage *pageForNewGlyph_StbText_(iStbText *d) {
+    iGlyphPage *page = page_StbText_(d, d->currentPage);
+    /* There must be room for all the offsets of the largest glyph. */
+    if (page->bottom <= d->cacheSize.y - maxGlyphHeight_Text_(&d->base)) {
+        return page;
+    }
+    if ((int) size_Array(&d->cachePages) < d->maxPages) {
+        d->currentPage = size_Array(&d->cachePages);
+        pushBack_Array(&d->cachePages, &(iGlyphPage){ .texture = NULL });
+        page = page_StbText_(d, d->currentPage);
+        init_GlyphPage(page, d);
+        return page;
+    }
+    /* Reuse the page that has gone unused the longest. */
+    int lru = 0;
+    iConstForEach(Array, i, &d->cachePages) {
+        const iGlyphPage *p = i.value;
+        if (d->cacheUseCounter - p->lastUsed >
+            d->cacheUseCounter - page_StbText_(d, lru)->lastUsed) {
+            lru = (int) index_ArrayConstIterator(&i);
+        }
+    }
+    evictPage_StbText_(d, lru);
+    d->currentPage = lru;
+    return page_StbText_(d, lru);
+}
+
+iLocalDef iCacheRow *cacheRow_GlyphPage_(iGlyphPage *d, int rowAllocStep, int height) {
+    return at_Array(&d->rows, (height - 1) / rowAllocStep);
+}
+
+static iInt2 assignCachePos_Text_(iStbText *d, iGlyphPage *page, iInt2 size) {
+    iCacheRow *cur = cacheRow_GlyphPage_(page, d->cacheRowAllocStep, size.y);
     if (cur->height == 0) {
         /* Begin a new row height. */
         cur->height = (1 + (size.y - 1) / d->cacheRowAllocStep) * d->cacheRowAllocStep;
-        cur->pos.y = d->cacheBottom;
-        d->cacheBottom = cur->pos.y + cur->height;
+        cur->pos.y = page->bottom;
+        page->bottom = cur->pos.y + cur->height;
     }
     iAssert(cur->height >= size.y);
-    /* TODO: Automatically enlarge the cache if running out of space?
-       Maybe make it paged, but beware of texture swapping too often inside a text string. */
     if (cur->pos.x + size.x > d->cacheSize.x) {
-        /* Does not fit on this row, advance to a new location in the cache. */
-        cur->pos.y = d->cacheBottom;
+        /* Does not fit on this row, advance to a new location in the page. */
+        cur->pos.y = page->bottom;
         cur->pos.x = 0;
-        d->cacheBottom += cur->height;
-        iAssert(d->cacheBottom <= d->cacheSize.y);
+        page->bottom += cur->height;
+        iAssert(page->bottom <= d->cacheSize.y);
     }
     const iInt2 assigned = cur->pos;
     cur->pos.x += size.x;
     return assigned;
 }
 
-static void allocate_Font_(iFont *d, iGlyph *glyph, int hoff) {
+static void allocate_Font_(iFont *d, iGlyph *glyph, iGlyphPage *page, int hoff) {
     iRect *glRect = &glyph->rect[hoff];
     int    x0, y0, x1, y1;
     measureGlyph_FontFile(d->font.file, index_Glyph_(glyph), d->xScale, d->yScale,
                           hoff * offsetStep_Glyph_(),
                           &x0, &y0, &x1, &y1);
     glRect->size = init_I2(x1 - x0, y1 - y0);
-    /* Determine placement in the glyph cache texture, advancing in rows. */
-    glRect->pos    = assignCachePos_Text_(current_StbText_(), glRect->size);
+    /* Determine placement in the glyph cache page, advancing in rows. */
+    glRect->pos    = assignCachePos_Text_(current_StbText_(), page, glRect->size);
     glyph->d[hoff] = init_I2(x0, y0);
     glyph->d[hoff].y += d->vertOffset;
     if (hoff == 0) { /* hoff>=1 uses same metrics as `glyph` */
@@ -648,28 +827,28 @@ static iGlyph *glyphByIndex_Font_(iFont *d, uint32_t glyphIndex) {
     if (!d->table) {
         d->table = new_GlyphTable();
     }
-    iGlyph* glyph = NULL;
-    void *  node = value_Hash(&d->table->glyphs, glyphIndex);
-    if (node) {
-        glyph = node;
+    iStbText *tx    = current_StbText_();
+    iGlyph   *glyph = glyph_GlyphTable_(d->table, glyphIndex);
+    if (glyph) {
+        page_StbText_(tx, glyph->page)->lastUsed = ++tx->cacheUseCounter;
+        tx->cacheStats.hits++;
     }
     else {
-        iStbText *tx = current_StbText_();
-        /* If the cache is running out of space, clear it and we'll recache what's needed currently. */
-        if (tx->cacheBottom > tx->cacheSize.y - maxGlyphHeight_Text_(&tx->base)) {
-#if !defined (NDEBUG)
-            printf("[Text] glyph cache is full, clearing!\n"); fflush(stdout);
-#endif
-            resetCache_StbText_(tx);
-        }
+        /* If the current page is running out of space, a new page is added or the least
+           recently used one is emptied. */
+        iGlyphPage *page = pageForNewGlyph_StbText_(tx);
         glyph = new_Glyph(glyphIndex);
         glyph->font = d;
+        glyph->page = (int) (page - (iGlyphPage *) data_Array(&tx->cachePages));
         /* New glyphs are always allocated at least. This reserves a position in the cache
            and updates the glyph metrics. */
         for (int offsetIndex = 0; offsetIndex < numOffsetSteps_Glyph_; offsetIndex++) {
-            allocate_Font_(d, glyph, offsetIndex);
+            allocate_Font_(d, glyph, page, offsetIndex);
         }
-        insert_Hash(&d->table->glyphs, &glyph->node);
+        insert_GlyphTable_(d->table, glyph);
+        pushBack_PtrArray(&page->glyphs, glyph);
+        page->lastUsed = ++tx->cacheUseCounter;
+        tx->cacheStats.misses++;
     }
     return glyph;
 }
@@ -720,19 +899,17 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
                                    d->font.height * 4 / 3);
     int          bufX    = 0;
     iArray *     rasters = NULL;
-    SDL_Texture *oldTarget = NULL;
-    iBool        isTargetChanged = iFalse;
     iAssert(isExposed_Window(get_Window()));
     /* We'll flush the buffered rasters periodically until everything is cached. */
     size_t index = 0;
     while (index < numGlyphIndices) {
         for (; index < numGlyphIndices; index++) {
             const uint32_t glyphIndex = glyphIndices[index];
-            const int lastCacheBottom = current_StbText_()->cacheBottom;
+            const uint32_t lastCacheGen = current_StbText_()->cacheGeneration;
             iGlyph *glyph = glyphByIndex_Font_(d, glyphIndex);
-            if (current_StbText_()->cacheBottom < lastCacheBottom) {
-                /* The cache was reset due to running out of space. We need to restart from
-                   the beginning! */
+            if (current_StbText_()->cacheGeneration != lastCacheGen) {
+                /* A page was emptied due to running out of space, possibly discarding
+                   glyphs buffered above. We need to restart from the beginning! */
                 bufX = 0;
                 if (rasters) {
                     clear_Array(rasters);
@@ -793,29 +970,27 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
                 }
             }
         }
-        /* Finished or the buffer is full, copy the glyphs to the cache texture. */
+        /* Finished or the buffer is full, copy the glyphs to the cache pages. The buffer is
+           converted to the page format once, and each glyph is uploaded as-is, avoiding a
+           32-bit intermediate texture and render target switches. */
         if (!isEmpty_Array(rasters)) {
-            SDL_Renderer *render = current_Text()->render;
-            SDL_Texture *bufTex = SDL_CreateTextureFromSurface(render, buf);
-            SDL_SetTextureBlendMode(bufTex, SDL_BLENDMODE_NONE);
-            if (!isTargetChanged) {
-                isTargetChanged = iTrue;
-                oldTarget = SDL_GetRenderTarget(render);
-                SDL_SetRenderTarget(render, current_StbText_()->cache);
-            }
-//            printf("copying %zu rasters from %p\n", size_Array(rasters), bufTex); fflush(stdout);
+            SDL_Surface *pageBuf = SDL_ConvertSurfaceFormat(buf, LAGRANGE_GLYPH_CACHE_FORMAT, 0);
+            const int    bpp     = SDL_BYTESPERPIXEL(LAGRANGE_GLYPH_CACHE_FORMAT);
+//            printf("copying %zu rasters from %p\n", size_Array(rasters), pageBuf); fflush(stdout);
             iConstForEach(Array, i, rasters) {
                 const iRasterGlyph *rg = i.value;
 //                iAssert(isEqual_I2(rg->rect.size, rg->glyph->rect[rg->hoff].size));
                 const iRect *glRect = &rg->glyph->rect[rg->hoff];
-                SDL_RenderCopy(render,
-                               bufTex,
-                               (const SDL_Rect *) &rg->rect,
-                               (const SDL_Rect *) glRect);
+                const iRect  dst    = { glRect->pos, min_I2(glRect->size, rg->rect.size) };
+                SDL_UpdateTexture(glyphTexture_StbText_(current_StbText_(), rg->glyph),
+                                  (const SDL_Rect *) &dst,
+                                  (const uint8_t *) pageBuf->pixels +
+                                      rg->rect.pos.y * pageBuf->pitch + rg->rect.pos.x * bpp,
+                                  pageBuf->pitch);
                 setRasterized_Glyph_(rg->glyph, rg->hoff);
 //                printf(" - %u (hoff %d)\n", index_Glyph_(rg->glyph), rg->hoff);
             }
-            SDL_DestroyTexture(bufTex);
+            SDL_FreeSurface(pageBuf);
             /* Resume with an empty buffer. */
             clear_Array(rasters);
             bufX = 0;
@@ -827,9 +1002,6 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
     if (buf) {
         SDL_FreeSurface(buf);
     }
-    if (isTargetChanged) {
-        SDL_SetRenderTarget(current_Text()->render, oldTarget);
-    }
 }
 
 iLocalDef void cacheSingleGlyph_Font_(iFont *d, uint32_t glyphIndex) {
@@ -1324,11 +1496,14 @@ void process_RunLayer_(iRunLayer *d, int layerIndex) {
                         iAssert(isRasterized_Glyph_(glyph, hoff));
                     }
                     if (~d->mode & permanentColorFlag_RunMode) {
-                        SDL_SetTextureColorMod(current_StbText_()->cache, fgClr.r, fgClr.g, fgClr.b);
+                        setColorMod_StbText_(current_StbText_(), fgClr);
                     }
                     SDL_Rect src;
                     memcpy(&src, &glyph->rect[hoff], sizeof(SDL_Rect));
-                    SDL_RenderCopy(current_Text()->render, current_StbText_()->cache, &src, &dst);
+                    SDL_RenderCopy(current_Text()->render,
+                                   glyphTexture_StbText_(current_StbText_(), glyph),
+                                   &src,
+                                   &dst);
                 }
 #if 0
                 /* Show spaces and direction. */
@@ -1401,8 +1576,7 @@ static void run_Font_(iFont *d, const iRunArgs *args) {
     iBool       didFindCachedFontRun = iFalse;
     /* Set the default text foreground color. */
     if (mode & draw_RunMode) {
-        const iColor clr = get_Color(args->color);
-        SDL_SetTextureColorMod(current_StbText_()->cache, clr.r, clr.g, clr.b);
+        setColorMod_StbText_(current_StbText_(), get_Color(args->color));
     }
     iAssert(args->text.end >= args->text.start);
     /* We keep a small cache of recently shaped runs because preparing these can be expensive.
@@ -1809,5 +1983,15 @@ void resetMissing_Text(iText *d) {
 }
 
 SDL_Texture *glyphCache_Text(void) {
-    return current_StbText_()->cache;
+    /* Only the current page, for debugging. */
+    iStbText *d = current_StbText_();
+    return page_StbText_(d, d->currentPage)->texture;
+}
+
+iGlyphCacheStats glyphCacheStats_Text(void) {
+    iStbText *d = current_StbText_();
+    iGlyphCacheStats stats = d->cacheStats;
+    stats.numPages = (int) size_Array(&d->cachePages);
+    stats.maxPages = d->maxPages;
+    return stats;
 }
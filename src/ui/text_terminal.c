@@ -179,6 +179,10 @@ SDL_Texture *glyphCache_Text(void) {
     return NULL;
 }
 
+iGlyphCacheStats glyphCacheStats_Text(void) {
+    return (iGlyphCacheStats){ 0 };
+}
+
 void setOpacity_Text(float opacity) {
     iUnused(opacity);
 }
@@ -4224,6 +4224,7 @@ static iBool handleBookmarkCreationCommands_SidebarWidget_(iWidget *editor, cons
                 bm->flags |= linkSplit_BookmarkFlag;
             }
             bm->parentId = folder ? id_Bookmark(folder) : 0;
+            invalidate_Bookmarks(bookmarks_App());
             setRecentFolder_Bookmarks(bookmarks_App(), bm->parentId);
             postCommandf_App("bookmarks.changed added:%zu", id);
         }
@@ -4290,6 +4291,7 @@ static iBool handleFeedSettingCommands_(iWidget *dlg, const char *cmd) {
         bm->flags |= subscribed_BookmarkFlag;
         iChangeFlags(bm->flags, headings_BookmarkFlag, headings);
         iChangeFlags(bm->flags, ignoreWeb_BookmarkFlag, ignoreWeb);
+        invalidate_Bookmarks(bookmarks_App());
         postCommand_App("bookmarks.changed");
         setupSheetTransition_Mobile(dlg, dialogTransitionDir_Widget(dlg));
         destroy_Widget(dlg);
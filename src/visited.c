@@ -22,15 +22,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "visited.h"
 #include "app.h"
+#include "trigramindex.h"
 
 #include <the_Foundation/file.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/ptrarray.h>
-#include <the_Foundation/sortedarray.h>
 
 const int maxAge_Visited = 6 * 3600 * 24 * 30; /* six months */
 
+static const char *visitedFilename_Visited_     = "visited.2.txt";
+static const char *tempVisitedFilename_Visited_ = "visited.2.txt.tmp";
+
+/* Only used in the file: a later line that removes the URL. */
+static const uint16_t removed_VisitedUrlFlag_ = 0x8000;
+
 void init_VisitedUrl(iVisitedUrl *d) {
     initCurrent_Time(&d->when);
     init_String(&d->url);
@@ -41,33 +47,386 @@ void deinit_VisitedUrl(iVisitedUrl *d) {
     deinit_String(&d->url);
 }
 
-static int cmpUrl_VisitedUrl_(const void *a, const void *b) {
-    return cmpString_String(&((const iVisitedUrl *) a)->url, &((const iVisitedUrl *) b)->url);
+/*----------------------------------------------------------------------------------------------*/
+
+enum iVisitedChunkSize {
+    numRecordsPerChunk_Visited_ = 1024,
+};
+
+iDeclareType(VisitedSlot)
+
+struct Impl_VisitedSlot {
+    uint32_t hash;
+    uint32_t record; /* index plus one; zero if the slot is unused */
+};
+
+static const uint32_t deletedRecord_VisitedSlot_ = 0xffffffff;
+
+/* Visits are immutable once created. A changed visit replaces the record's entry, so readers
+   on other threads can hold references to entries without a lock. */
+iDeclareClass(VisitedEntry)
+
+struct Impl_VisitedEntry {
+    iObject     object;
+    iVisitedUrl visit;
+};
+
+void init_VisitedEntry(iVisitedEntry *d, const iString *url, iTime when, uint16_t flags) {
+    /* A deep copy, so the text isn't shared between threads. */
+    initRange_String(&d->visit.url, range_String(url));
+    d->visit.when  = when;
+    d->visit.flags = flags;
 }
 
-static int cmpNewer_VisitedUrl_(const void *insert, const void *existing) {
-    return seconds_Time(&((const iVisitedUrl *) insert  )->when) >=
-           seconds_Time(&((const iVisitedUrl *) existing)->when);
+void deinit_VisitedEntry(iVisitedEntry *d) {
+    deinit_VisitedUrl(&d->visit);
 }
 
-/*----------------------------------------------------------------------------------------------*/
+iDefineObjectConstructionArgs(VisitedEntry,
+                              (const iString *url, iTime when, uint16_t flags),
+                              url, when, flags)
+iDefineClass(VisitedEntry)
+
+iDeclareType(VisitedRecord)
+
+struct Impl_VisitedRecord {
+    iVisitedEntry *entry; /* NULL if the record is unused */
+    uint32_t       older; /* time order: index plus one, or zero at the end of the list */
+    uint32_t       newer;
+};
+
+/* Background readers iterate a snapshot of references to the entries. The entries themselves
+   are shared, so taking a snapshot copies no text. */
+iDeclareClass(VisitedSnapshot)
+
+struct Impl_VisitedSnapshot {
+    iObject object;
+    iArray  records;     /* VisitedEntry pointers by record index; NULL if unused */
+    iArray  newestFirst; /* record indices in time order */
+};
+
+void init_VisitedSnapshot(iVisitedSnapshot *d) {
+    init_Array(&d->records, sizeof(iVisitedEntry *));
+    init_Array(&d->newestFirst, sizeof(uint32_t));
+}
+
+void deinit_VisitedSnapshot(iVisitedSnapshot *d) {
+    iForEach(Array, i, &d->records) {
+        iRelease(*(iVisitedEntry **) i.value);
+    }
+    deinit_Array(&d->newestFirst);
+    deinit_Array(&d->records);
+}
+
+iDefineObjectConstruction(VisitedSnapshot)
+iDefineClass(VisitedSnapshot)
+
+static const iVisitedUrl *record_VisitedSnapshot_(const iVisitedSnapshot *d, size_t index) {
+    const iVisitedEntry *entry = *(iVisitedEntry * const *) constAt_Array(&d->records, index);
+    return entry ? &entry->visit : NULL;
+}
 
 struct Impl_Visited {
-    iMutex *mtx;
-    iSortedArray visited;
+    iMutex *      mtx;
+    iPtrArray     chunks;      /* arrays of VisitedUrl records that never move in memory */
+    size_t        numRecords;  /* allocated records, including removed ones */
+    iArray        freeRecords; /* indices of removed records, to be reused */
+    iVisitedSlot *slots;       /* open addressing hash table of URLs */
+    size_t        numSlots;    /* power of two */
+    size_t        numOccupied; /* slots that are either in use or deleted */
+    size_t        numUrls;
+    uint32_t      newest;      /* head of the time-ordered list of records (index plus one) */
+    iString       journal;     /* lines not yet appended to the file */
+    size_t        numJournaled;
+    size_t        numSuperseded; /* lines in the file that no longer correspond to a record */
+    iBool         needCompaction;
+    uint32_t      generation;  /* incremented whenever visit times change */
+    iTrigramIndex urlIndex;    /* record indices by URL trigrams; built when first searched */
+    iBool         isUrlIndexValid;
+    iVisitedSnapshot *snapshot; /* references to the current entries; released on any change */
 };
 
 iDefineTypeConstruction(Visited)
 
+uint32_t urlHash_Visited(const iString *canonicalUrl) {
+    return iCrc32(cstr_String(canonicalUrl), size_String(canonicalUrl));
+}
+
+static iVisitedRecord *entry_Visited_(const iVisited *d, size_t index) {
+    return (iVisitedRecord *) at_PtrArray(&d->chunks, index / numRecordsPerChunk_Visited_) +
+           index % numRecordsPerChunk_Visited_;
+}
+
+static const iVisitedUrl *record_Visited_(const iVisited *d, size_t index) {
+    /* The record must be in use. */
+    return &entry_Visited_(d, index)->entry->visit;
+}
+
+static iBool isUsed_Visited_(const iVisited *d, size_t index) {
+    return entry_Visited_(d, index)->entry != NULL;
+}
+
+static void setRecord_Visited_(iVisited *d, size_t index, iTime when, uint16_t flags) {
+    /* Caller must hold the mutex. Readers may still be using the old entry. */
+    iVisitedRecord *rec = entry_Visited_(d, index);
+    iVisitedEntry  *old = rec->entry;
+    rec->entry = new_VisitedEntry(&old->visit.url, when, flags);
+    iRelease(old);
+}
+
+static size_t findSlot_Visited_(const iVisited *d, const iString *url, uint32_t hash) {
+    /* Caller must hold the mutex. */
+    if (!d->numSlots) {
+        return iInvalidPos;
+    }
+    const size_t mask = d->numSlots - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        const iVisitedSlot *slot = &d->slots[i];
+        if (!slot->record) {
+            return iInvalidPos;
+        }
+        if (slot->record != deletedRecord_VisitedSlot_ && slot->hash == hash &&
+            equal_String(&record_Visited_(d, slot->record - 1)->url, url)) {
+            return i;
+        }
+    }
+}
+
+static void placeSlot_Visited_(iVisited *d, uint32_t hash, uint32_t record) {
+    /* Caller must hold the mutex. The URL must not be in the table. */
+    const size_t mask = d->numSlots - 1;
+    size_t i = hash & mask;
+    while (d->slots[i].record && d->slots[i].record != deletedRecord_VisitedSlot_) {
+        i = (i + 1) & mask;
+    }
+    if (!d->slots[i].record) {
+        d->numOccupied++;
+    }
+    d->slots[i] = (iVisitedSlot){ .hash = hash, .record = record };
+}
+
+static void rehash_Visited_(iVisited *d) {
+    /* Caller must hold the mutex. Deleted slots are dropped at the same time. */
+    size_t newSize = 64;
+    while (newSize < (d->numUrls + 1) * 2) {
+        newSize *= 2;
+    }
+    iVisitedSlot *oldSlots = d->slots;
+    const size_t  oldSize  = d->numSlots;
+    d->slots       = calloc(newSize, sizeof(iVisitedSlot));
+    d->numSlots    = newSize;
+    d->numOccupied = 0;
+    for (size_t i = 0; i < oldSize; i++) {
+        if (oldSlots[i].record && oldSlots[i].record != deletedRecord_VisitedSlot_) {
+            placeSlot_Visited_(d, oldSlots[i].hash, oldSlots[i].record);
+        }
+    }
+    free(oldSlots);
+}
+
+static size_t insert_Visited_(iVisited *d, const iString *url, uint32_t hash, iTime when,
+                              uint16_t flags) {
+    /* Caller must hold the mutex. The URL must not be in the table. */
+    if ((d->numOccupied + 1) * 4 > d->numSlots * 3) {
+        rehash_Visited_(d);
+    }
+    size_t index;
+    if (!isEmpty_Array(&d->freeRecords)) {
+        index = *(const uint32_t *) back_Array(&d->freeRecords);
+        popBack_Array(&d->freeRecords);
+    }
+    else {
+        if (d->numRecords == size_PtrArray(&d->chunks) * numRecordsPerChunk_Visited_) {
+            pushBack_PtrArray(&d->chunks,
+                              malloc(sizeof(iVisitedRecord) * numRecordsPerChunk_Visited_));
+        }
+        index = d->numRecords++;
+    }
+    entry_Visited_(d, index)->entry = new_VisitedEntry(url, when, flags);
+    if (d->isUrlIndexValid) {
+        add_TrigramIndex(&d->urlIndex, (uint32_t) index, range_String(url));
+    }
+    placeSlot_Visited_(d, hash, (uint32_t) index + 1);
+    d->numUrls++;
+    return index;
+}
+
+static void remove_Visited_(iVisited *d, size_t slotIndex) {
+    /* Caller must hold the mutex. */
+    iVisitedSlot *slot  = &d->slots[slotIndex];
+    const uint32_t index = slot->record - 1;
+    if (d->isUrlIndexValid) {
+        remove_TrigramIndex(&d->urlIndex, index, range_String(&record_Visited_(d, index)->url));
+    }
+    iVisitedRecord *rec = entry_Visited_(d, index);
+    iReleasePtr(&rec->entry); /* marks the record unused */
+    pushBack_Array(&d->freeRecords, &index);
+    slot->record = deletedRecord_VisitedSlot_;
+    d->numUrls--;
+}
+
+static void invalidateSnapshot_Visited_(iVisited *d) {
+    /* Caller must hold the mutex. Readers keep their own references to the old copy. */
+    if (d->snapshot) {
+        iRelease(d->snapshot);
+        d->snapshot = NULL;
+    }
+}
+
+static iVisitedSnapshot *snapshot_Visited_(iVisited *d) {
+    /* Caller must hold the mutex. Made once per change, when a background reader needs it. */
+    if (!d->snapshot) {
+        iVisitedSnapshot *snap = new_VisitedSnapshot();
+        resize_Array(&snap->records, d->numRecords);
+        for (size_t i = 0; i < d->numRecords; i++) {
+            iVisitedEntry *entry = entry_Visited_(d, i)->entry;
+            *(iVisitedEntry **) at_Array(&snap->records, i) = entry ? ref_Object(entry) : NULL;
+        }
+        for (uint32_t i = d->newest; i; i = entry_Visited_(d, i - 1)->older) {
+            pushBack_Array(&snap->newestFirst, &(uint32_t){ i - 1 });
+        }
+        d->snapshot = snap;
+    }
+    return d->snapshot;
+}
+
+static const iVisitedSnapshot *collectSnapshot_Visited_(const iVisited *d) {
+    /* The returned snapshot stays valid until the current garbage scope ends. */
+    iVisitedSnapshot *snap;
+    iGuardMutex(d->mtx, snap = ref_Object(snapshot_Visited_(iConstCast(iVisited *, d))));
+    return iClob(snap);
+}
+
+static void linkTime_Visited_(iVisited *d, size_t index) {
+    /* Caller must hold the mutex. Most visits are the newest one, so the position is found
+       quickly by starting from the head. */
+    iVisitedRecord *rec   = entry_Visited_(d, index);
+    uint32_t        older = d->newest;
+    uint32_t        newer = 0;
+    while (older && cmp_Time(&record_Visited_(d, older - 1)->when,
+                             &rec->entry->visit.when) > 0) {
+        newer = older;
+        older = entry_Visited_(d, older - 1)->older;
+    }
+    rec->older = older;
+    rec->newer = newer;
+    if (older) {
+        entry_Visited_(d, older - 1)->newer = (uint32_t) index + 1;
+    }
+    if (newer) {
+        entry_Visited_(d, newer - 1)->older = (uint32_t) index + 1;
+    }
+    else {
+        d->newest = (uint32_t) index + 1;
+    }
+}
+
+static void unlinkTime_Visited_(iVisited *d, size_t index) {
+    /* Caller must hold the mutex. */
+    const iVisitedRecord *rec = entry_Visited_(d, index);
+    if (rec->older) {
+        entry_Visited_(d, rec->older - 1)->newer = rec->newer;
+    }
+    if (rec->newer) {
+        entry_Visited_(d, rec->newer - 1)->older = rec->older;
+    }
+    else {
+        d->newest = rec->older;
+    }
+}
+
+iDeclareType(VisitedTimeIndex)
+
+struct Impl_VisitedTimeIndex {
+    iTime    when;
+    uint32_t index;
+};
+
+static int cmp_VisitedTimeIndex_(const void *a, const void *b) {
+    const iVisitedTimeIndex *x = a, *y = b;
+    const int cmp = cmp_Time(&x->when, &y->when);
+    return cmp ? cmp : iCmp(x->index, y->index);
+}
+
+static void relinkTime_Visited_(iVisited *d) {
+    /* Caller must hold the mutex. The entire list is rebuilt after loading many records. */
+    iArray order;
+    init_Array(&order, sizeof(iVisitedTimeIndex));
+    for (size_t i = 0; i < d->numRecords; i++) {
+        if (isUsed_Visited_(d, i)) {
+            pushBack_Array(&order, &(iVisitedTimeIndex){ record_Visited_(d, i)->when, (uint32_t) i });
+        }
+    }
+    sort_Array(&order, cmp_VisitedTimeIndex_);
+    uint32_t older = 0;
+    iConstForEach(Array, i, &order) {
+        const uint32_t  index = ((const iVisitedTimeIndex *) i.value)->index;
+        iVisitedRecord *rec   = entry_Visited_(d, index);
+        rec->older = older;
+        rec->newer = 0;
+        if (older) {
+            entry_Visited_(d, older - 1)->newer = index + 1;
+        }
+        older = index + 1;
+    }
+    d->newest = older;
+    deinit_Array(&order);
+}
+
+static void journal_Visited_(iVisited *d, const iVisitedUrl *vis, uint16_t flags) {
+    /* Caller must hold the mutex. */
+    if (startsWithCase_String(&vis->url, "data:")) {
+        return;
+    }
+    appendFormat_String(&d->journal,
+                        "%llu %04x %s\n",
+                        (unsigned long long) integralSeconds_Time(&vis->when),
+                        flags,
+                        cstr_String(&vis->url));
+    d->numJournaled++;
+}
+
+static void journalRemoved_Visited_(iVisited *d, const iString *url) {
+    /* Caller must hold the mutex. */
+    iVisitedUrl removed = { .url = *url };
+    initCurrent_Time(&removed.when);
+    journal_Visited_(d, &removed, removed_VisitedUrlFlag_);
+}
+
 void init_Visited(iVisited *d) {
     d->mtx = new_Mutex();
-    init_SortedArray(&d->visited, sizeof(iVisitedUrl), cmpUrl_VisitedUrl_);
+    init_PtrArray(&d->chunks);
+    d->numRecords = 0;
+    init_Array(&d->freeRecords, sizeof(uint32_t));
+    d->slots = NULL;
+    d->numSlots = 0;
+    d->numOccupied = 0;
+    d->numUrls = 0;
+    d->newest = 0;
+    init_String(&d->journal);
+    d->numJournaled = 0;
+    d->numSuperseded = 0;
+    d->needCompaction = iFalse;
+    d->generation = 0;
+    init_TrigramIndex(&d->urlIndex);
+    d->isUrlIndexValid = iFalse;
+    d->snapshot = NULL;
 }
 
 void deinit_Visited(iVisited *d) {
     iGuardMutex(d->mtx, {
-        clear_Visited(d);
-        deinit_SortedArray(&d->visited);
+        for (size_t i = 0; i < d->numRecords; i++) {
+            iRelease(entry_Visited_(d, i)->entry);
+        }
+        iForEach(PtrArray, c, &d->chunks) {
+            free(c.ptr);
+        }
+        deinit_PtrArray(&d->chunks);
+        deinit_Array(&d->freeRecords);
+        free(d->slots);
+        deinit_String(&d->journal);
+        deinit_TrigramIndex(&d->urlIndex);
+        invalidateSnapshot_Visited_(d);
     });
     delete_Mutex(d->mtx);
 }
@@ -75,8 +434,11 @@ void deinit_Visited(iVisited *d) {
 void serialize_Visited(const iVisited *d, iStream *out) {
     iString *line = new_String();
     lock_Mutex(d->mtx);
-    iConstForEach(Array, i, &d->visited.values) {
-        const iVisitedUrl *item = i.value;
+    for (size_t i = 0; i < d->numRecords; i++) {
+        if (!isUsed_Visited_(d, i)) {
+            continue;
+        }
+        const iVisitedUrl *item = record_Visited_(d, i);
         if (startsWithCase_String(&item->url, "data:")) {
             continue;
         }
@@ -91,18 +453,52 @@ void serialize_Visited(const iVisited *d, iStream *out) {
     delete_String(line);
 }
 
-void save_Visited(const iVisited *d, const char *dirPath) {
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
+static void compact_Visited_(iVisited *d, const char *dirPath) {
+    /* Caller must hold the mutex. The file is rewritten with only the current records. */
+    const char *tempPath = concatPath_CStr(dirPath, tempVisitedFilename_Visited_);
+    iFile *f = newCStr_File(tempPath);
     if (open_File(f, writeOnly_FileMode | text_FileMode)) {
         serialize_Visited(d, stream_File(f));
+        close_File(f);
+        commitFile_App(concatPath_CStr(dirPath, visitedFilename_Visited_), tempPath);
+        d->numSuperseded  = 0;
+        d->needCompaction = iFalse;
     }
     iRelease(f);
 }
 
+void save_Visited(iVisited *d, const char *dirPath) {
+    lock_Mutex(d->mtx);
+    if (d->numSuperseded + d->numJournaled > iMax(1000, d->numUrls)) {
+        /* Most of the file would be outdated lines. */
+        d->needCompaction = iTrue;
+    }
+    if (d->needCompaction) {
+        compact_Visited_(d, dirPath);
+    }
+    else if (d->numJournaled) {
+        iFile *f = newCStr_File(concatPath_CStr(dirPath, visitedFilename_Visited_));
+        if (open_File(f, append_FileMode | text_FileMode)) {
+            write_File(f, &d->journal.chars);
+            /* Each appended line replaces an earlier one, or is a removal. */
+            d->numSuperseded += d->numJournaled;
+        }
+        iRelease(f);
+    }
+    clear_String(&d->journal);
+    d->numJournaled = 0;
+    unlock_Mutex(d->mtx);
+}
+
 void deserialize_Visited(iVisited *d, iStream *ins, iBool mergeKeepingLatest) {
+    /* Later lines replace earlier ones for the same URL, because the file is appended to
+       as URLs are visited. */
     const iRangecc src  = range_Block(collect_Block(readAll_Stream(ins)));
     iRangecc       line = iNullRange;
+    iString        url;
     iTime          now;
+    size_t         numLines = 0;
+    init_String(&url);
     initCurrent_Time(&now);
     lock_Mutex(d->mtx);
     while (nextSplit_Rangecc(src, "\n", &line)) {
@@ -112,32 +508,45 @@ void deserialize_Visited(iVisited *d, iStream *ins, iBool mergeKeepingLatest) {
         if (ts == 0) break;
         const uint32_t flags = (uint32_t) strtoul(skipSpace_CStr(endp), &endp, 16);
         const char *urlStart = skipSpace_CStr(endp);
-        iVisitedUrl item;
-        item.when.ts = (struct timespec){ .tv_sec = ts };
-        if (~flags & kept_VisitedUrlFlag &&
-            secondsSince_Time(&now, &item.when) > maxAge_Visited) {
-            continue; /* Too old. */
+        numLines++;
+        iTime when;
+        when.ts = (struct timespec){ .tv_sec = ts };
+        setRange_String(&url, (iRangecc){ urlStart, line.end });
+        const uint32_t hash = urlHash_Visited(&url);
+        const size_t   slot = findSlot_Visited_(d, &url, hash);
+        if (flags & removed_VisitedUrlFlag_ ||
+            (~flags & kept_VisitedUrlFlag && secondsSince_Time(&now, &when) > maxAge_Visited)) {
+            /* Removed or too old. */
+            if (slot != iInvalidPos && !mergeKeepingLatest) {
+                remove_Visited_(d, slot);
+            }
+            continue;
         }
-        item.flags = flags;
-        initRange_String(&item.url, (iRangecc){ urlStart, line.end });
-        set_String(&item.url, &item.url);
-        if (mergeKeepingLatest) {
-            /* Check if we already have this. */
-            size_t existingPos;
-            if (locate_SortedArray(&d->visited, &item, &existingPos)) {
-                iVisitedUrl *existing = at_SortedArray(&d->visited, existingPos);
-                max_Time(&existing->when, &item.when);
-                existing->flags = item.flags;
-                continue;
+        if (slot != iInvalidPos) {
+            const size_t index = d->slots[slot].record - 1;
+            if (mergeKeepingLatest) {
+                max_Time(&when, &record_Visited_(d, index)->when);
             }
+            setRecord_Visited_(d, index, when, flags);
+            continue;
         }
-        insert_SortedArray(&d->visited, &item);
+        insert_Visited_(d, &url, hash, when, flags);
+    }
+    if (mergeKeepingLatest) {
+        d->needCompaction = iTrue;
     }
+    else {
+        d->numSuperseded += numLines - iMin(numLines, d->numUrls);
+    }
+    relinkTime_Visited_(d);
+    invalidateSnapshot_Visited_(d);
+    d->generation++;
     unlock_Mutex(d->mtx);
+    deinit_String(&url);
 }
 
 void load_Visited(iVisited *d, const char *dirPath) {
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
+    iFile *f = newCStr_File(concatPath_CStr(dirPath, visitedFilename_Visited_));
     if (open_File(f, readOnly_FileMode | text_FileMode)) {
         deserialize_Visited(d, stream_File(f), iFalse /* no merge */);
     }
@@ -146,25 +555,31 @@ void load_Visited(iVisited *d, const char *dirPath) {
 
 void clear_Visited(iVisited *d) {
     lock_Mutex(d->mtx);
-    iForEach(Array, v, &d->visited.values) {
-        deinit_VisitedUrl(v.value);
+    for (size_t i = 0; i < d->numRecords; i++) {
+        iRelease(entry_Visited_(d, i)->entry);
+    }
+    iForEach(PtrArray, c, &d->chunks) {
+        free(c.ptr);
     }
-    clear_SortedArray(&d->visited);
+    clear_PtrArray(&d->chunks);
+    clear_Array(&d->freeRecords);
+    free(d->slots);
+    d->slots          = NULL;
+    d->numSlots       = 0;
+    d->numOccupied    = 0;
+    d->numRecords     = 0;
+    d->numUrls        = 0;
+    d->newest         = 0;
+    d->needCompaction = iTrue;
+    clear_String(&d->journal);
+    d->numJournaled = 0;
+    d->generation++;
+    clear_TrigramIndex(&d->urlIndex);
+    d->isUrlIndexValid = iFalse;
+    invalidateSnapshot_Visited_(d);
     unlock_Mutex(d->mtx);
 }
 
-static size_t find_Visited_(const iVisited *d, const iString *url) {
-    iVisitedUrl visit;
-    init_VisitedUrl(&visit);
-    set_String(&visit.url, url);
-    size_t pos = iInvalidPos;
-    iGuardMutex(d->mtx, {
-        locate_SortedArray(&d->visited, &visit, &pos);
-        deinit_VisitedUrl(&visit);
-    });
-    return pos;
-}
-
 void visitUrl_Visited(iVisited *d, const iString *url, uint16_t visitFlags) {
     iTime when;
     initCurrent_Time(&when);
@@ -174,71 +589,96 @@ void visitUrl_Visited(iVisited *d, const iString *url, uint16_t visitFlags) {
 void visitUrlTime_Visited(iVisited *d, const iString *url, uint16_t visitFlags, iTime when) {
     if (isEmpty_String(url)) return;
     url = canonicalUrl_String(url);
-    iVisitedUrl visit;
-    init_VisitedUrl(&visit);
-    visit.when = when;
-    visit.flags = visitFlags;
-    set_String(&visit.url, url);
-    size_t pos;
+    const uint32_t hash = urlHash_Visited(url);
     lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &visit, &pos)) {
-        iVisitedUrl *old = at_SortedArray(&d->visited, pos);
-        if (old->flags & kept_VisitedUrlFlag) {
+    const size_t slot = findSlot_Visited_(d, url, hash);
+    size_t index;
+    if (slot != iInvalidPos) {
+        index = d->slots[slot].record - 1;
+        if (record_Visited_(d, index)->flags & kept_VisitedUrlFlag) {
             visitFlags |= kept_VisitedUrlFlag; /* must continue to be kept */
         }
-        if (cmpNewer_VisitedUrl_(&visit, old)) {
-            old->when = visit.when;
-            old->flags = visitFlags;
-            unlock_Mutex(d->mtx);
-            deinit_VisitedUrl(&visit);
-            return;
-        }
+        unlinkTime_Visited_(d, index);
+        setRecord_Visited_(d, index, when, visitFlags);
+    }
+    else {
+        index = insert_Visited_(d, url, hash, when, visitFlags);
     }
-    insert_SortedArray(&d->visited, &visit);
+    linkTime_Visited_(d, index);
+    journal_Visited_(d, record_Visited_(d, index), visitFlags);
+    invalidateSnapshot_Visited_(d);
+    d->generation++;
     unlock_Mutex(d->mtx);
 }
 
 void setUrlKept_Visited(iVisited *d, const iString *url, iBool isKept) {
     if (isEmpty_String(url)) return;
-    iVisitedUrl visit;
-    init_VisitedUrl(&visit);
-    set_String(&visit.url, canonicalUrl_String(url));
-    size_t pos;
+    url = canonicalUrl_String(url);
+    const uint32_t hash = urlHash_Visited(url);
     lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &visit, &pos)) {
-        iVisitedUrl *vis = at_SortedArray(&d->visited, pos);
-        iChangeFlags(vis->flags, kept_VisitedUrlFlag, isKept);
+    const size_t slot = findSlot_Visited_(d, url, hash);
+    if (slot != iInvalidPos) {
+        const size_t       index = d->slots[slot].record - 1;
+        const iVisitedUrl *vis   = record_Visited_(d, index);
+        if (((vis->flags & kept_VisitedUrlFlag) != 0) != isKept) {
+            uint16_t flags = vis->flags;
+            iChangeFlags(flags, kept_VisitedUrlFlag, isKept);
+            setRecord_Visited_(d, index, vis->when, flags);
+            journal_Visited_(d, record_Visited_(d, index), flags);
+            invalidateSnapshot_Visited_(d);
+        }
     }
     unlock_Mutex(d->mtx);
-    deinit_VisitedUrl(&visit);
 }
 
 void removeUrl_Visited(iVisited *d, const iString *url) {
     url = canonicalUrl_String(url);
-    iGuardMutex(d->mtx, {
-        size_t pos = find_Visited_(d, url);
-        if (pos < size_SortedArray(&d->visited)) {
-            iVisitedUrl *visUrl = at_SortedArray(&d->visited, pos);
-            if (equal_String(&visUrl->url, url)) {
-                deinit_VisitedUrl(visUrl);
-                remove_Array(&d->visited.values, pos);
-            }
-        }
-    });
+    const uint32_t hash = urlHash_Visited(url);
+    lock_Mutex(d->mtx);
+    const size_t slot = findSlot_Visited_(d, url, hash);
+    if (slot != iInvalidPos) {
+        journalRemoved_Visited_(d, url);
+        unlinkTime_Visited_(d, d->slots[slot].record - 1);
+        remove_Visited_(d, slot);
+        invalidateSnapshot_Visited_(d);
+        d->generation++;
+    }
+    unlock_Mutex(d->mtx);
 }
 
 iTime urlVisitTime_Visited(const iVisited *d, const iString *url) {
-    iVisitedUrl item;
-    size_t pos;
-    iZap(item);
-    initCopy_String(&item.url, canonicalUrl_String(url));
+    iTime when;
+    iZap(when);
+    url = canonicalUrl_String(url);
+    const uint32_t hash = urlHash_Visited(url);
+    lock_Mutex(d->mtx);
+    const size_t slot = findSlot_Visited_(d, url, hash);
+    if (slot != iInvalidPos) {
+        when = record_Visited_(d, d->slots[slot].record - 1)->when;
+    }
+    unlock_Mutex(d->mtx);
+    return when;
+}
+
+uint32_t generation_Visited(const iVisited *d) {
+    uint32_t gen;
+    iGuardMutex(d->mtx, gen = d->generation);
+    return gen;
+}
+
+void query_Visited(const iVisited *d, iVisitedQuery *queries, size_t count) {
     lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &item, &pos)) {
-        item.when = ((const iVisitedUrl *) constAt_SortedArray(&d->visited, pos))->when;
+    for (size_t i = 0; i < count; i++) {
+        iVisitedQuery *q = &queries[i];
+        const size_t slot = findSlot_Visited_(d, q->url, q->hash);
+        if (slot != iInvalidPos) {
+            q->when = record_Visited_(d, d->slots[slot].record - 1)->when;
+        }
+        else {
+            iZap(q->when);
+        }
     }
     unlock_Mutex(d->mtx);
-    deinit_String(&item.url);
-    return item.when;
 }
 
 iBool containsUrl_Visited(const iVisited *d, const iString *url) {
@@ -246,37 +686,79 @@ iBool containsUrl_Visited(const iVisited *d, const iString *url) {
     return isValid_Time(&time);
 }
 
-static int cmpWhenDescending_VisitedUrlPtr_(const void *a, const void *b) {
-    const iVisitedUrl *s = *(const void **) a, *t = *(const void **) b;
-    return -cmp_Time(&s->when, &t->when);
-}
-
 const iPtrArray *list_Visited(const iVisited *d, size_t count) {
     iPtrArray *urls = collectNew_PtrArray();
-    iGuardMutex(d->mtx, {
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *vis = i.value;
-            if (~vis->flags & transient_VisitedUrlFlag) {
-                pushBack_PtrArray(urls, vis);
+    if (count) {
+        /* Only the newest entries are referenced, so this is cheap to call after every
+           change, unlike taking a snapshot of all records. */
+        lock_Mutex(d->mtx);
+        for (uint32_t i = d->newest; i && size_PtrArray(urls) < count;
+             i = entry_Visited_(d, i - 1)->older) {
+            iVisitedEntry *entry = entry_Visited_(d, i - 1)->entry;
+            if (~entry->visit.flags & transient_VisitedUrlFlag) {
+                pushBack_PtrArray(urls, &((iVisitedEntry *) iClob(ref_Object(entry)))->visit);
             }
         }
-    });
-    sort_Array(urls, cmpWhenDescending_VisitedUrlPtr_);
-    if (count > 0 && size_Array(urls) > count) {
-        resize_Array(urls, count);
+        unlock_Mutex(d->mtx);
+        return urls;
+    }
+    const iVisitedSnapshot *snap = collectSnapshot_Visited_(d);
+    iConstForEach(Array, i, &snap->newestFirst) {
+        const iVisitedUrl *vis = record_VisitedSnapshot_(snap, *(const uint32_t *) i.value);
+        if (~vis->flags & transient_VisitedUrlFlag) {
+            pushBack_PtrArray(urls, vis);
+        }
     }
     return urls;
 }
 
+static void validateUrlIndex_Visited_(iVisited *d) {
+    /* Caller must hold the mutex. After this, the index is updated as records change. */
+    if (d->isUrlIndexValid) {
+        return;
+    }
+    for (size_t i = 0; i < d->numRecords; i++) {
+        if (isUsed_Visited_(d, i)) {
+            add_TrigramIndex(&d->urlIndex, (uint32_t) i, range_String(&record_Visited_(d, i)->url));
+        }
+    }
+    d->isUrlIndexValid = iTrue;
+}
+
+const iPtrArray *listMatching_Visited(const iVisited *d, const iString *term) {
+    iIntSet ids;
+    init_IntSet(&ids);
+    lock_Mutex(d->mtx);
+    validateUrlIndex_Visited_(iConstCast(iVisited *, d));
+    if (!query_TrigramIndex(&d->urlIndex, term, &ids)) {
+        /* The term is too short to narrow down the search. */
+        unlock_Mutex(d->mtx);
+        deinit_IntSet(&ids);
+        return list_Visited(d, 0);
+    }
+    /* Record indices in the index match the snapshot taken at the same time. */
+    iVisitedSnapshot *snap = ref_Object(snapshot_Visited_(iConstCast(iVisited *, d)));
+    unlock_Mutex(d->mtx);
+    iClob(snap);
+    iPtrArray *urls = collectNew_PtrArray();
+    iConstForEach(IntSet, i, &ids) {
+        const iVisitedUrl *vis = record_VisitedSnapshot_(snap, *i.value);
+        if (~vis->flags & transient_VisitedUrlFlag) {
+            pushBack_PtrArray(urls, vis);
+        }
+    }
+    deinit_IntSet(&ids);
+    return urls;
+}
+
 const iPtrArray *listKept_Visited(const iVisited *d) {
+    const iVisitedSnapshot *snap = collectSnapshot_Visited_(d);
     iPtrArray *urls = collectNew_PtrArray();
-    iGuardMutex(d->mtx, {
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *vis = i.value;
-            if (vis->flags & kept_VisitedUrlFlag) {
-                pushBack_PtrArray(urls, vis);
-            }
+    for (size_t i = 0; i < size_Array(&snap->records); i++) {
+        const iVisitedUrl *vis = record_VisitedSnapshot_(snap, i);
+        if (vis && vis->flags & kept_VisitedUrlFlag) {
+            pushBack_PtrArray(urls, vis);
         }
-    });
+    }
     return urls;
 }
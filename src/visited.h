@@ -44,12 +44,20 @@ enum iVisitedUrlFlag {
     kept_VisitedUrlFlag      = 0x2, /* don't discard this even after max age */
 };
 
+iDeclareType(VisitedQuery)
+
+struct Impl_VisitedQuery {
+    const iString *url;  /* canonical */
+    uint32_t       hash; /* see `urlHash_Visited` */
+    iTime          when; /* result; invalid if the URL has not been visited */
+};
+
 iDeclareType(Visited)
 iDeclareTypeConstruction(Visited)
 
 void    clear_Visited           (iVisited *);
 void    load_Visited            (iVisited *, const char *dirPath);
-void    save_Visited            (const iVisited *, const char *dirPath);
+void    save_Visited            (iVisited *, const char *dirPath); /* appends recent changes */
 void    serialize_Visited       (const iVisited *, iStream *out);
 void    deserialize_Visited     (iVisited *, iStream *ins, iBool mergeKeepingLatest);
 
@@ -59,6 +67,11 @@ void    visitUrlTime_Visited    (iVisited *, const iString *url, uint16_t visitF
 void    setUrlKept_Visited      (iVisited *, const iString *url, iBool isKept); /* URL is marked as (non)discardable */
 void    removeUrl_Visited       (iVisited *, const iString *url);
 iBool   containsUrl_Visited     (const iVisited *, const iString *url);
+uint32_t generation_Visited     (const iVisited *); /* changes when any visit time changes */
+void    query_Visited           (const iVisited *, iVisitedQuery *queries, size_t count); /* one lock for all */
+
+uint32_t urlHash_Visited        (const iString *canonicalUrl);
 
-const iPtrArray *   list_Visited        (const iVisited *, size_t count); /* returns collected */
+const iPtrArray *   list_Visited        (const iVisited *, size_t count); /* collected; entries are immutable */
 const iPtrArray *   listKept_Visited    (const iVisited *);
+const iPtrArray *   listMatching_Visited(const iVisited *, const iString *term); /* may contain the words of `term`; returns collected */